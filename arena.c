@@ -1,3 +1,6 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include <sys/mman.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -6,6 +9,46 @@
 #include <assert.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdalign.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <stddef.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#if defined(__has_include)
+#if __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#define ARENA_HAVE_RSEQ 1
+#endif
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+//offset of an object from the start of its Arena. Offsets stay valid wherever the arena is mapped, so they are used instead of pointers inside file backed arenas. 0 is never a valid allocation and is used as the null offset
+typedef uint64_t ArenaOffset;
+
+//magic number stored in the header of file backed arenas so a reopened file can be validated
+#define ARENA_FILE_MAGIC 0x454c4946414e5241ULL
+//magic number stored in the header of shared memory arenas
+#define ARENA_SHARED_MAGIC 0x4445524148534e41ULL
+//magic number stored in the header of arena images written by ArenaSave
+#define ARENA_IMAGE_MAGIC 0x4547414d494e5241ULL
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+//flags for ArenaAllocEx
+//fault every page of the arena in when it is allocated, so pushes never take a page fault
+#define ARENA_POPULATE 1
+//lock the arena in RAM with mlock as well. Implies ARENA_POPULATE
+#define ARENA_LOCK 2
 
 typedef struct Arena_t {
 	//pointer to the current position in the arena stack
@@ -26,11 +69,322 @@ typedef struct Arena_t {
 	uintptr_t alignment;
 	//Boolean that determines if the Arena is meant to hold a single type or not. You must set this if you want the extra features of a single type Arena
 	bool one_type;
+	//address the arena was mapped at when ptr, first_ptr and end_ptr were written. Only differs from the arena's own address after a file backed arena is reopened, see ArenaRebase
+	uintptr_t base;
+	//offset of the root object of a file backed arena, set with ArenaSetRoot so the data can be found again after a reload
+	ArenaOffset root;
+	//ARENA_FILE_MAGIC for file backed arenas, ARENA_SHARED_MAGIC for shared memory arenas, 0 otherwise
+	uint64_t magic;
+	//offset of the next free byte in a shared memory arena. Only accessed atomically, by ArenaPushShared
+	ArenaOffset shared_top;
+	//memfd backing the arena, -1 if the arena is not memfd backed
+	int fd;
+	//true if the arena is a private copy-on-write mapping of fd, which happens after ArenaClone or ArenaSnapshot
+	bool cow;
+	//bitmap arena with one bit per page written since the last ArenaCheckpoint. NULL unless ArenaTrackDirty was called
+	struct Arena_t* dirty;
+	//bitmap arena with one bit per slot of a single type Arena, set while the slot holds a live element. NULL unless ArenaTrackOccupancy was called, in which case it replaces the free_list
+	struct Arena_t* occupancy;
+	//number of dropped slots below ptr while occupancy is tracked
+	size_t holes;
+	//lowest word of the occupancy bitmap that can have a hole in it
+	size_t hole_hint;
+	//arena holding the ArenaHandleTable of a single type Arena. NULL unless ArenaTrackHandles was called
+	struct Arena_t* handles;
+	//number of bytes past ptr that ArenaSetTouchAhead keeps faulted in, 0 if it isn't used
+	size_t touch_ahead;
+	//end of the region that has been faulted in by touch-ahead
+	uintptr_t touched_ptr;
+	//ArenaPush faults in the next touch_ahead bytes once ptr passes this. It is end_ptr when touch-ahead is off so the check never fires
+	uintptr_t touch_at;
+	//bottom of the scratch space pushed with ArenaPushHigh, which grows down from end_ptr towards ptr. It is end_ptr while the top end is empty
+	uintptr_t high_ptr;
+	//thread allowed to push to a single type Arena once ArenaSetOwner was called. ArenaDrop from any other thread goes to remote_free instead of the free_list
+	pthread_t owner;
+	bool owned;
+	//slots dropped by threads other than the owner, linked through their first word. Other threads add to it with a CAS and the owner takes the whole list at once when it runs out of holes
+	void* remote_free;
+	//finalizers registered with ArenaPushWithCleanup, newest first. NULL for arenas that never used it, which keeps ArenaDropTo down to one extra compare
+	struct ArenaCleanup* cleanups;
+	//arena this one was carved from with ArenaAllocSub, NULL for arenas with a mapping of their own
+	struct Arena_t* parent;
+	//number of sub-arenas carved from this one that haven't been released yet
+	size_t children;
+	//slot of the arena in the shared stats page, NULL unless ArenaPublishStats was called. ArenaPush only keeps counters while it is set
+	struct ArenaStats* stats;
 } Arena;
 
+//called with the object when the memory ArenaPushWithCleanup returned is dropped or the arena released
+typedef void (*ArenaCleanupFn)(void* obj);
+
+//record kept in the arena right after an object pushed with ArenaPushWithCleanup
+typedef struct ArenaCleanup {
+	ArenaCleanupFn fn;
+	void* obj;
+	struct ArenaCleanup* next;
+} ArenaCleanup;
+
+//reference to an element of a single type Arena that stays valid when ArenaSwap or ArenaDefrag move the element, and goes stale once the element is dropped
+typedef struct ArenaHandle {
+	uint32_t index;
+	uint32_t generation;
+} ArenaHandle;
+
+typedef struct ArenaHandleEntry {
+	//slot of the element while the entry is in use, the next free entry while it isn't
+	uint32_t slot;
+	//bumped every time the element is dropped, so handles to it stop resolving
+	uint32_t generation;
+} ArenaHandleEntry;
+
+//marks an unused entry or a slot without a handle
+#define ARENA_NO_HANDLE UINT32_MAX
+
+//indirection table from handles to slots. It is followed in the same arena by capacity entries and then capacity slot owners, the entry index of the handle for every slot
+typedef struct ArenaHandleTable {
+	size_t capacity;
+	//first entry of the free entry chain
+	uint32_t free_head;
+	//number of entries that have ever been used
+	uint32_t top;
+} ArenaHandleTable;
+
+//how pages written since the last ArenaCheckpoint are found. The mode is picked once per process by ArenaTrackDirty
+typedef enum ArenaDirtyMode {
+	ARENA_DIRTY_NONE,
+	//soft-dirty bits from /proc/self/pagemap, needs a kernel built with CONFIG_MEM_SOFT_DIRTY
+	ARENA_DIRTY_SOFT,
+	//the arena is mapped read only and the first write to each page is caught in a SIGSEGV handler
+	ARENA_DIRTY_MPROTECT,
+} ArenaDirtyMode;
+
+//maximum number of arenas that can be tracked with ArenaTrackDirty at the same time
+#define ARENA_MAX_TRACKED 64
+//maximum number of arenas in the registry that ArenaReport lists. Arenas created past that still work, they are just not reported
+#define ARENA_MAX_REGISTERED 256
+//longest name ArenaSetName keeps, including the terminating 0
+#define ARENA_NAME_SIZE 32
+//magic number at the start of a checkpoint written by ArenaCheckpoint
+#define ARENA_DELTA_MAGIC 0x41544c4544414e52ULL
+//magic number at the start of the stats page published by ArenaPublishStats
+#define ARENA_STATS_MAGIC 0x5354415441414e52ULL
+
+//counters of one arena in the stats page. Only the thread pushing to the arena writes them, with relaxed stores and no locked instructions, and arenatop reads them from another process without taking any lock, so watching a process costs its threads nothing. One cache line per arena so arenas pushed to from different threads don't share one
+typedef struct ArenaStats {
+	//address of the arena while the slot is in use, 0 while it is free
+	uint64_t arena __attribute__((aligned(64)));
+	//bumped every time the slot is given to another arena, so a reader knows the counters started over
+	uint64_t generation;
+	//bytes used at both ends of the arena after the last push or drop
+	uint64_t used;
+	uint64_t high_water;
+	//successful pushes
+	uint64_t pushes;
+	//pushes that returned NULL because the arena was full
+	uint64_t failures;
+	char name[ARENA_NAME_SIZE];
+} ArenaStats;
+
+//shared memory page of one process at /arenastats.<pid>, created by the first ArenaPublishStats
+typedef struct ArenaStatsPage {
+	uint64_t magic;
+	uint64_t pid;
+	uint64_t slots;
+	ArenaStats stats[ARENA_MAX_REGISTERED];
+} ArenaStatsPage;
+
+//how many slots ahead of the cursor ArenaForEach prefetches
+#define ARENA_PREFETCH_AHEAD 8
+
+//called by ArenaForEach with every live element of a single type Arena
+typedef void (*ArenaVisitFn)(void* elem, void* ctx);
+//called by ArenaForEachRun with every run of count live elements that sit next to each other, starting at first
+typedef void (*ArenaRunFn)(void* first, size_t count, void* ctx);
+
+//called by ArenaReorder for every element it moves, with the address it was at and the one it is at now
+typedef void (*ArenaMovedFn)(void* from, void* to, void* ctx);
+//returns the key ArenaReorderBy sorts an element by
+typedef uint64_t (*ArenaKeyFn)(const void* elem, void* ctx);
+
+//FIFO arena for streaming data. The ring's memfd is mapped twice back to back right after the header page, so a push that wraps past the end is still one contiguous block. head and tail count every byte ever pushed and dropped, so head - tail is the used space and neither index needs to wrap. They sit on their own cache lines since one producer writes head and one consumer writes tail
+typedef struct ArenaRing {
+	//bytes in the ring, a multiple of the page size
+	size_t size;
+	//memfd mapped twice at data
+	int fd;
+	//first of the two mappings of the memfd
+	char* data;
+	//bytes committed by the producer. Only written by ArenaRingCommit and ArenaRingReadFrom
+	uint64_t head __attribute__((aligned(64)));
+	//bytes dropped by the consumer. Only written by ArenaRingDrop and ArenaRingWriteTo
+	uint64_t tail __attribute__((aligned(64)));
+} ArenaRing;
+
+//set of arenas that ArenaFrameBegin rotates through, so the data of the last count - 1 frames stays readable while the next frame is built. It lives in its own small arena together with the arenas and peaks arrays
+typedef struct ArenaFrames {
+	//arena holding this struct and the arrays
+	Arena* holder;
+	//number of arenas in the rotation
+	unsigned count;
+	//index of the arena handed out by the last ArenaFrameBegin
+	unsigned current;
+	//whether pages past the learned frame size are given back to the kernel when an arena is reset
+	bool decommit;
+	//bytes a frame has needed lately. Follows bigger frames straight away and shrinks slowly after them
+	size_t learned;
+	//the arenas, oldest first after current
+	Arena** arenas;
+	//highest ptr each arena has reached since its pages were last decommitted
+	uintptr_t* peaks;
+} ArenaFrames;
+
+//maximum number of reader threads that can join an ArenaEpoch
+#define ARENA_MAX_READERS 64
+
+struct ArenaEpoch;
+
+//slot of one reader thread in an ArenaEpoch. Each slot has its own cache line so readers never write to a line another thread is using
+typedef struct ArenaEpochReader {
+	//global epoch when the reader last entered, 0 while it is outside
+	uint64_t epoch __attribute__((aligned(64)));
+	//set while a thread has the slot
+	uint32_t joined;
+	struct ArenaEpoch* domain;
+} ArenaEpochReader;
+
+//ArenaDrop or ArenaDropTo that is waiting for readers to leave the epoch it was retired in
+typedef struct ArenaRetired {
+	Arena* arena;
+	//element to ArenaDrop, or position to ArenaDropTo
+	void* ptr;
+	//ptr of the arena when an ArenaDropTo was retired, 0 for an ArenaDrop
+	uintptr_t top;
+	uint64_t epoch;
+} ArenaRetired;
+
+//epoch based reclamation domain. Readers enter and leave epochs around their traversals, the writer retires drops instead of doing them and ArenaEpochReclaim runs the ones no reader can still see. It lives in its own small arena, the retired drops in another
+typedef struct ArenaEpoch {
+	//starts at 1 and is bumped by every ArenaEpochReclaim
+	uint64_t global __attribute__((aligned(64)));
+	ArenaEpochReader readers[ARENA_MAX_READERS];
+	//arena holding this struct
+	Arena* holder;
+	//stack of ArenaRetired in the order they were retired
+	Arena* retired;
+} ArenaEpoch;
+
+//one arena of an ArenaShards, on its own cache line
+typedef struct ArenaShard {
+	//spinlock held while a thread pushes to the shard. Threads only contend on it when they are preempted or migrated in the middle of a push
+	int lock __attribute__((aligned(64)));
+	Arena* arena;
+} ArenaShard;
+
+//one arena per CPU. ArenaShardPush pushes to the arena of the CPU the calling thread is running on, so memory and cache footprint follow the number of cores instead of the number of threads. It lives in its own small arena together with the shards
+typedef struct ArenaShards {
+	Arena* holder;
+	unsigned count;
+	ArenaShard* shards;
+} ArenaShards;
+
+//number of slots a thread can keep in an ArenaMagazine
+#define ARENA_MAGAZINE_SIZE 64
+
+//lock-free pool of fixed size slots laid out like a single type Arena, that any thread can take slots from and give them back to. Free slots are kept in batches on a Treiber stack: the first word of every free slot holds the index of the next slot in its batch and the second word the index of the first slot of the next batch, both + 1 so 0 ends a list. It lives in its own small arena, the slots in another
+typedef struct ArenaPool {
+	//index + 1 of the first slot of the top batch in the low 32 bits and a tag in the high 32 bits. The tag is bumped by every change so a head that was popped and pushed back in between never wins a CAS
+	uint64_t head __attribute__((aligned(64)));
+	//number of slots ever handed out by the bump
+	uint64_t top __attribute__((aligned(64)));
+	Arena* holder;
+	//single type Arena holding the slots
+	Arena* arena;
+	size_t slot;
+	size_t capacity;
+} ArenaPool;
+
+//per thread cache of pool slots, owned by the caller. Taking from and giving back to it needs no atomics, the pool is only touched to refill it or to hand back half of it when it is full. Start with count 0
+typedef struct ArenaMagazine {
+	unsigned count;
+	void* slots[ARENA_MAGAZINE_SIZE];
+} ArenaMagazine;
+
+static ArenaDirtyMode arena_dirty_mode = ARENA_DIRTY_NONE;
+static Arena* arena_tracked[ARENA_MAX_TRACKED];
+//every live arena with a mapping of its own, for ArenaReport. Slots are claimed with a CAS and cleared by ArenaRelease, so a signal handler can walk them at any time
+static Arena* arena_registry[ARENA_MAX_REGISTERED];
+static char arena_registry_names[ARENA_MAX_REGISTERED][ARENA_NAME_SIZE];
+//number of arenas that were created while every registry slot was taken, and so never show up in ArenaReport
+static uint64_t arena_registry_dropped;
+
 int ArenaSetAlignment(Arena* arena, size_t new_alignment);
+void* ArenaPush(Arena* arena, size_t size);
+void* ArenaPushAligned(Arena* arena, size_t size, size_t align);
+void* ArenaPushAlignedWithCleanup(Arena* arena, size_t size, size_t align, ArenaCleanupFn fn);
+void ArenaDropTo(Arena* arena, void* pos);
+int ArenaRelease(Arena* arena);
+void ArenaUntrackDirty(Arena* arena);
+void ArenaTouchAhead(Arena* arena);
+static void ArenaTouchForget(Arena* arena);
 
-Arena* ArenaAlloc (unsigned pages) {
+//sets up the header of a freshly mapped arena. size is the usable size in bytes, not counting the guard page
+static void ArenaInit(Arena* arena, size_t size) {
+	arena->ptr = (uintptr_t) arena + sizeof(Arena);
+	arena->alignment = 8;
+	arena->size = size;
+	arena->end_ptr = (uintptr_t)arena + arena->size;
+	arena->free_list = NULL;
+	arena->one_type = false;
+	arena->elem_size = 0;
+	arena->to_free = NULL;
+	arena->first_ptr = arena->ptr;
+	arena->base = (uintptr_t)arena;
+	arena->root = 0;
+	arena->magic = 0;
+	arena->shared_top = 0;
+	arena->fd = -1;
+	arena->cow = false;
+	arena->dirty = NULL;
+	arena->occupancy = NULL;
+	arena->holes = 0;
+	arena->hole_hint = 0;
+	arena->handles = NULL;
+	arena->touch_ahead = 0;
+	arena->touched_ptr = arena->ptr;
+	arena->touch_at = arena->end_ptr;
+	arena->high_ptr = arena->end_ptr;
+	arena->owned = false;
+	arena->remote_free = NULL;
+	arena->cleanups = NULL;
+	arena->parent = NULL;
+	arena->children = 0;
+	arena->stats = NULL;
+}
+
+//adds a new arena to the registry, if there is a free slot left
+static void ArenaRegister(Arena* arena) {
+	for (int i = 0; i < ARENA_MAX_REGISTERED; i++) {
+		Arena* expected = NULL;
+		if (!__atomic_load_n(&arena_registry[i], __ATOMIC_RELAXED) &&
+			__atomic_compare_exchange_n(&arena_registry[i], &expected, arena, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+			return;
+		}
+	}
+	__atomic_fetch_add(&arena_registry_dropped, 1, __ATOMIC_RELAXED);
+}
+
+static void ArenaUnregister(Arena* arena) {
+	for (int i = 0; i < ARENA_MAX_REGISTERED; i++) {
+		if (__atomic_load_n(&arena_registry[i], __ATOMIC_RELAXED) == arena) {
+			arena_registry_names[i][0] = 0;
+			__atomic_store_n(&arena_registry[i], (Arena*)NULL, __ATOMIC_RELEASE);
+			return;
+		}
+	}
+}
+
+//maps an arena without putting it in the registry. Used for the side arenas the library keeps for itself, like free lists, bitmaps and scratch, which would otherwise fill the registry with unnamed rows. The arenas that hold user data, like frames, shards and the pool's slots, come from ArenaAlloc and are listed, only their holders are not
+static Arena* ArenaAllocSide(unsigned pages) {
 	// get system page size
 	int16_t page_size = getpagesize();
 	if (page_size == -1) {
@@ -45,175 +399,3023 @@ Arena* ArenaAlloc (unsigned pages) {
 		perror("couldn't allocate arena");
 		exit(EXIT_FAILURE);
 	}
-	arena->ptr = (uintptr_t) arena + sizeof(Arena);
-	arena->alignment = 8;
-	arena->size = alloc - page_size;
-	arena->end_ptr = (uintptr_t)arena + arena->size;
-	arena->free_list = NULL;
-	arena->one_type = false;
-	arena->elem_size = 0;
-	arena->to_free = NULL;
-	arena->first_ptr = arena->ptr;
+	ArenaInit(arena, alloc - page_size);
 	if(mprotect((void*)(arena->end_ptr), page_size, PROT_NONE) != 0){
 		return NULL;
 	}
 	return arena;
 }
 
+Arena* ArenaAlloc (unsigned pages) {
+	Arena* arena = ArenaAllocSide(pages);
+	if (arena) {
+		ArenaRegister(arena);
+	}
+	return arena;
+}
+
+//takes a side arena out of the header of its owner before releasing it, so an ArenaReport run from a signal handler never follows the pointer into an unmapped arena
+static void ArenaReleaseSide(Arena** side) {
+	Arena* arena = *side;
+	__atomic_store_n(side, (Arena*)NULL, __ATOMIC_RELEASE);
+	ArenaRelease(arena);
+}
+
+//runs the finalizers of an arena and gives back everything it holds outside its own memory
+static void ArenaTeardown(Arena* arena) {
+	//each record is unlinked before it runs, so a finalizer that drops the arena doesn't run the rest twice
+	while (arena->cleanups) {
+		ArenaCleanup* cleanup = arena->cleanups;
+		arena->cleanups = cleanup->next;
+		cleanup->fn(cleanup->obj);
+	}
+	if (arena->touch_ahead) {
+		ArenaTouchForget(arena);
+	}
+	if (arena->dirty) {
+		ArenaUntrackDirty(arena);
+	}
+	//release the free list first. The header is not written to since snapshots are mapped read only
+	if (arena->free_list) {
+		ArenaReleaseSide(&arena->free_list);
+	}
+	if (arena->occupancy) {
+		ArenaReleaseSide(&arena->occupancy);
+	}
+	if (arena->handles) {
+		ArenaReleaseSide(&arena->handles);
+	}
+	if (arena->stats) {
+		__atomic_store_n(&arena->stats->arena, (uint64_t)0, __ATOMIC_RELEASE);
+	}
+}
+
+//record ArenaAllocSub registered on the parent for a sub-arena, right after its block
+static ArenaCleanup* ArenaSubRecord(Arena* sub) {
+	return (ArenaCleanup*)((uintptr_t)sub + ((sub->size + sizeof(void*) - 1) & ~(sizeof(void*) - 1)));
+}
+
+//stands in for ArenaSubTeardown once the sub-arena was released on its own
+static void ArenaSubReleased(void* sub) {
+	(void)sub;
+}
+
+//finalizer of a sub-arena on its parent, so dropping the parent to below it or releasing the parent tears it down too
+static void ArenaSubTeardown(void* obj) {
+	Arena* sub = (Arena*)obj;
+	ArenaTeardown(sub);
+	assert(sub->parent->children > 0);
+	sub->parent->children--;
+}
+
 int ArenaRelease(Arena* arena) {
 	if (!arena) {
 		return -1;
 	}
-	//release the free list first
-	if (arena->free_list) {
-		ArenaRelease(arena->free_list);
-		arena->free_list = NULL;
+	//out of the registry before anything is torn down, so a report can't see the arena half released
+	if (!arena->parent) {
+		ArenaUnregister(arena);
+	}
+	ArenaTeardown(arena);
+	//a sub-arena has no mapping of its own, its block goes back to the parent if nothing was pushed on top of it since
+	if (arena->parent) {
+		Arena* parent = arena->parent;
+		ArenaCleanup* record = ArenaSubRecord(arena);
+		//the parent must not tear it down a second time
+		record->fn = ArenaSubReleased;
+		assert(parent->children > 0);
+		parent->children--;
+		if (parent->ptr == (((uintptr_t)(record + 1) + parent->alignment - 1) & ~(parent->alignment - 1))) {
+			ArenaDropTo(parent, arena);
+		}
+		return 0;
+	}
+	int fd = arena->fd;
+	int res = munmap(arena, arena->size + getpagesize());
+	if (fd >= 0) {
+		close(fd);
 	}
-	return munmap(arena, arena->size + getpagesize());
+	return res;
 }
 
-//returns -1 if the alignment specified is not possible
-int ArenaSetAlignment(Arena* arena, size_t new_alignment) {
-	assert(arena->ptr < arena->end_ptr);
-	assert(new_alignment != 0);
-	//check if new_alignment is not a power of 2
-	if ((new_alignment & (new_alignment - 1)) != 0) {
-		return -1;
+//carves a child Arena of size bytes, header included, out of parent without a new mapping or a system call. The child has the same push and drop API and bounds checks as any other Arena, can be made single type, and starts zeroed. ArenaRelease on it drops the parent back to below it if it is still the last thing pushed, otherwise its space comes back once the parent is dropped to below it. A child that is still live when the parent is dropped to below it or released is torn down with it like an object pushed with ArenaPushWithCleanup, its finalizers run and it must not be used or released after that. Sub-arenas have no fd, no guard page and can't track dirty pages. Returns NULL if the parent doesn't have room
+Arena* ArenaAllocSub(Arena* parent, size_t size) {
+	if (!parent || parent->one_type || size <= sizeof(Arena) + 64) {
+		fprintf(stderr, "Something went wrong calling ArenaAllocSub() parent = %p\n size = %ld\n", parent, size);
+		return NULL;
 	}
-	arena->alignment = new_alignment;
-	arena->ptr = (arena->ptr + arena->alignment -1) & ~(arena->alignment -1);
-	arena->first_ptr = (arena->first_ptr + arena->alignment -1) & ~(arena->alignment -1);
-	return 0;
+	//64 so the child can use any alignment up to a cache line
+	Arena* sub = (Arena*)ArenaPushAlignedWithCleanup(parent, size, 64, ArenaSubTeardown);
+	if (!sub) {
+		return NULL;
+	}
+	memset(sub, 0, size);
+	ArenaInit(sub, size);
+	sub->parent = parent;
+	parent->children++;
+	return sub;
 }
 
+//pages of the per thread arena that ArenaScratch carves the temporary arenas of ArenaSwap, ArenaDefrag and friends out of. Only the pages that get used are faulted in
+#define ARENA_SCRATCH_PAGES 256
 
-void ArenaDrop (Arena* arena, void* ptr); 
+static pthread_key_t arena_scratch_key;
+static pthread_once_t arena_scratch_once = PTHREAD_ONCE_INIT;
 
-//pushes a new element to the Arena. If the Arena is of a single type and ArenaPop was called, it will insert the newest element into the last hole left by ArenaDrop()
-void* ArenaPush(Arena* arena, size_t size) {
-	assert(arena->ptr < arena->end_ptr);
-	if (!arena || size == 0 || (arena->ptr + size + arena->alignment) >=  arena->end_ptr){
-		fprintf(stderr, "Something went wrong with the ArenaPush().\n arena = %p\n size to push = %ld\n arena->alignment = %ld\n arena->ptr = %ld\n arena->end_ptr = %ld\n", arena, size, arena->alignment, arena->ptr, arena->end_ptr);
+static void ArenaScratchDestroy(void* scratch) {
+	ArenaRelease((Arena*)scratch);
+}
+
+static void ArenaScratchKey(void) {
+	pthread_key_create(&arena_scratch_key, ArenaScratchDestroy);
+}
+
+//temporary arena with room for bytes, released with ArenaRelease like any other. It is a sub-arena of the calling thread's scratch arena when it fits, so the internal scratch arenas cost a few stores instead of an mmap, an mprotect and a munmap, and only falls back to a mapping of its own for big requests. The scratch arena is created on first use and released when the thread exits
+static Arena* ArenaScratch(size_t bytes) {
+	long page_size = getpagesize();
+	pthread_once(&arena_scratch_once, ArenaScratchKey);
+	Arena* scratch = (Arena*)pthread_getspecific(arena_scratch_key);
+	if (!scratch) {
+		scratch = ArenaAllocSide(ARENA_SCRATCH_PAGES);
+		pthread_setspecific(arena_scratch_key, scratch);
+	}
+	//sub-arenas released out of order are only given back once none are left, along with the records of the released ones
+	if (scratch->children == 0) {
+		ArenaDropTo(scratch, (void*)scratch->first_ptr);
+	}
+	//room for the header, a few pushes rounded up to the alignment and the padding to a cache line
+	size_t size = sizeof(Arena) + bytes + 256;
+	if (size + 128 < scratch->high_ptr - scratch->ptr) {
+		return ArenaAllocSub(scratch, size);
+	}
+	return ArenaAllocSide((bytes + page_size - 1) / page_size + 1);
+}
+
+//moves the pointers stored in the header of an arena that was mapped at a different address than the one it was written at. The free_list and the bitmaps are separate mappings that do not survive a reload, so the holes they tracked are lost and stay as zeroed slots. Finalizers belong to the arena they were registered in, so a reloaded or cloned arena doesn't run them. The memfd and copy-on-write state belong to the old mapping and are reset as well
+static void ArenaRebase(Arena* arena) {
+	uintptr_t delta = (uintptr_t)arena - arena->base;
+	arena->ptr += delta;
+	arena->first_ptr += delta;
+	arena->end_ptr += delta;
+	arena->high_ptr += delta;
+	arena->base = (uintptr_t)arena;
+	arena->fd = -1;
+	arena->cow = false;
+	arena->free_list = NULL;
+	arena->to_free = NULL;
+	arena->dirty = NULL;
+	arena->occupancy = NULL;
+	arena->holes = 0;
+	arena->hole_hint = 0;
+	arena->handles = NULL;
+	arena->touch_ahead = 0;
+	arena->touched_ptr = arena->ptr;
+	arena->touch_at = arena->end_ptr;
+	arena->owned = false;
+	arena->remote_free = NULL;
+	arena->cleanups = NULL;
+	arena->parent = NULL;
+	arena->children = 0;
+	arena->stats = NULL;
+}
+
+//creates an arena backed by the file at path, or reopens it if the file already exists. A new file is sized to hold the requested pages, an existing file keeps its size and contents and pages is ignored. The file is mapped MAP_SHARED, so the data can be used straight away after a restart. Link objects inside the arena with ArenaOffset instead of pointers since the file can be mapped at a different address every time. Returns NULL if the file can't be opened or isn't an arena file
+Arena* ArenaAllocFile(const char* path, unsigned pages) {
+	long page_size = getpagesize();
+	int fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd == -1) {
+		perror("couldn't open arena file");
 		return NULL;
 	}
-	void* newptr;
-	newptr = NULL;
-	//reuse a free spot if one is available
-		if (arena->free_list && arena->to_free && arena->one_type){
-			//if a free list exists, it must already be of one_type unless something went horribly wrong
-			assert(arena->one_type == true);
-			assert(arena->elem_size > 0);
-			newptr = *arena->to_free; 
-			memset(newptr, 0, arena->elem_size);
-			ArenaDrop(arena->free_list, arena->to_free);
-			if (arena->free_list->first_ptr == arena->free_list->ptr) {
-				//we are at the end (or start, depending on how you look at it) of the free_list
-				arena->to_free = NULL;
-			} else {
-				arena->to_free = (void**) ArenaPush(arena->free_list, sizeof(void*));
-			}
-		} else {
-			newptr = (void*) arena->ptr;
-			arena->to_free = NULL;
-			arena->ptr = (arena->ptr + size + (arena->alignment -1)) & ~(arena->alignment -1);
-			if (arena->one_type) {
-				memset(newptr, 0, arena->elem_size);
-			}
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		perror("couldn't stat arena file");
+		close(fd);
+		return NULL;
+	}
+	bool reopen = st.st_size > 0;
+	size_t alloc = reopen ? (size_t)st.st_size : ((size_t)pages + 1) * page_size;
+	if (reopen && (alloc % page_size != 0 || alloc < 2 * (size_t)page_size)) {
+		fprintf(stderr, "%s is not an arena file\n", path);
+		close(fd);
+		return NULL;
+	}
+	if (!reopen && ftruncate(fd, alloc) != 0) {
+		perror("couldn't size arena file");
+		close(fd);
+		return NULL;
+	}
+	Arena* arena = (Arena*) mmap(NULL, alloc, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (arena == (Arena*)MAP_FAILED) {
+		perror("couldn't map arena file");
+		return NULL;
+	}
+	if (reopen) {
+		if (arena->magic != ARENA_FILE_MAGIC || arena->size != alloc - page_size) {
+			fprintf(stderr, "%s is not an arena file\n", path);
+			munmap(arena, alloc);
+			return NULL;
 		}
-		//if the size of the push is not aligned with the arena, this aligns the pointer
-
-	return newptr;
+		ArenaRebase(arena);
+	} else {
+		ArenaInit(arena, alloc - page_size);
+		arena->magic = ARENA_FILE_MAGIC;
+	}
+	if(mprotect((void*)(arena->end_ptr), page_size, PROT_NONE) != 0){
+		munmap(arena, alloc);
+		return NULL;
+	}
+	ArenaRegister(arena);
+	return arena;
 }
 
+//flushes a file backed arena to disk. Once this returns the file can be reopened with ArenaAllocFile and used as is
+int ArenaSync(Arena* arena) {
+	if (!arena) {
+		return -1;
+	}
+	return msync(arena, arena->size, MS_SYNC);
+}
 
+//converts a pointer into the arena to an offset that stays valid wherever the arena is mapped. NULL maps to 0
+ArenaOffset ArenaOffsetOf(Arena* arena, void* ptr) {
+	if (!ptr) {
+		return 0;
+	}
+	assert((uintptr_t)ptr > (uintptr_t)arena && (uintptr_t)ptr <= (uintptr_t)arena + arena->size);
+	return (ArenaOffset)((uintptr_t)ptr - (uintptr_t)arena);
+}
 
-void ArenaDropTo (Arena* arena, void* pos) {
-	assert(arena->ptr < arena->end_ptr);
-	if (!arena || !pos || 
-		(uintptr_t)pos > arena->end_ptr || 
-		(uintptr_t)pos < arena->first_ptr) {
-		fprintf(stderr,"Something went wrong calling ArenaDropTo() arena = %p\n ArenaPopTo position = %p\n arena->end_ptr = %ld \n", arena, pos, arena->end_ptr);
-		return;
+//converts an offset from ArenaOffsetOf back to a pointer for the current mapping of the arena. 0 maps to NULL
+void* ArenaOffsetPtr(Arena* arena, ArenaOffset offset) {
+	if (!offset) {
+		return NULL;
 	}
+	assert(offset <= arena->size);
+	return (void*)((uintptr_t)arena + offset);
+}
 
-	arena->ptr = ((uintptr_t)pos + arena->alignment -1) & ~(arena->alignment -1);
+//records the object that a reloaded file backed arena should be entered through
+void ArenaSetRoot(Arena* arena, void* ptr) {
+	arena->root = ArenaOffsetOf(arena, ptr);
 }
 
-//this function only works for Arenas of a single type where the element size is the same size or larger than the alignment. It will "free" the location in memory provided by the pointer and add that address to the free list so that ArenaPush can use it next time
-void ArenaDrop (Arena* arena, void* ptr) {
-	assert(arena->ptr < arena->end_ptr);
-	assert(arena->one_type == true);
-	assert(arena->elem_size > 0);
-	assert(arena->ptr >= arena->first_ptr);
-	assert(arena->elem_size >= arena->alignment);
+void* ArenaGetRoot(Arena* arena) {
+	return ArenaOffsetPtr(arena, arena->root);
+}
 
-	if( arena->ptr == arena->first_ptr) {
-		fprintf(stderr, "Tried to ArenaDrop() on an Arena that hasn't had anything added to it or has been ArenaPopTo()'d the start of the Arena\n");
-		arena->to_free = NULL;
-		ArenaRelease(arena->free_list);
+//maps alloc bytes of anonymous memory at exactly base. Returns NULL if any part of the range is already in use
+static Arena* ArenaMapAt(void* base, size_t alloc) {
+	void* mem = mmap(base, alloc, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+	if (mem == MAP_FAILED) {
+		return NULL;
 	}
-	
-	//if ptr is the top element in the Arena stack, just ArenaDropTo() the ptr
-	if ((((arena->ptr - arena->elem_size) + arena->alignment -1) & ~(arena->alignment -1) ) == (((uintptr_t)ptr + arena->alignment -1) & ~(arena->alignment -1))) {
-		ArenaDropTo(arena, ptr);
-	} else {
-		//if there is no free_list, make one
-		if (!(arena->free_list)) {
-			arena->free_list = ArenaAlloc(((arena->size / arena->elem_size) + getpagesize() -1) / getpagesize());
-			arena->free_list->one_type = true;
-			arena->free_list->elem_size = sizeof(void*);
-			ArenaSetAlignment(arena->free_list, sizeof(void*));
-		}
-		//this is just in case the free_list ArenaAlloc() fails
-		assert(arena->free_list != NULL);
-		arena->to_free = (void**)ArenaPush(arena->free_list, sizeof(void*));
-		if(arena->to_free){
-			*(arena->to_free) = ptr;
-		} else {
-			fprintf(stderr, "Failed to set up void** to_free for Arena\n");
-		}
+	//kernels older than 4.17 treat MAP_FIXED_NOREPLACE as a hint and may map somewhere else
+	if (mem != base) {
+		munmap(mem, alloc);
+		return NULL;
 	}
+	return (Arena*)mem;
 }
 
-//Just like ArenaDrop, but 0's the memory indicated by the ptr
-void ArenaPop (Arena* arena, void* ptr) {
-	ArenaDrop(arena, ptr);
-	memset(ptr, 0, arena->elem_size);
+//allocates an arena at the virtual address base, which must be page aligned. Raw pointers into an arena at a fixed base stay valid when it is saved with ArenaSave and reloaded with ArenaLoad. Returns NULL if the address range is already taken
+Arena* ArenaAllocAt(void* base, unsigned pages) {
+	long page_size = getpagesize();
+	if ((uintptr_t)base % page_size != 0) {
+		fprintf(stderr, "ArenaAllocAt() base %p is not page aligned\n", base);
+		return NULL;
+	}
+	size_t alloc = ((size_t)pages + 1) * page_size;
+	Arena* arena = ArenaMapAt(base, alloc);
+	if (!arena) {
+		return NULL;
+	}
+	ArenaInit(arena, alloc - page_size);
+	if(mprotect((void*)(arena->end_ptr), page_size, PROT_NONE) != 0){
+		munmap(arena, alloc);
+		return NULL;
+	}
+	ArenaRegister(arena);
+	return arena;
 }
 
-//swaps two elements of an Arena. Only works for Arenas of a single type
-void ArenaSwap(Arena* arena, void* elem1, void* elem2) {
-	assert(arena->one_type == true);
-	assert(arena->elem_size > 0);
-	uint page_size = getpagesize();
-	Arena* scratch = ArenaAlloc((arena->elem_size + page_size -1) / page_size);
-	void* buffer = ArenaPush(scratch, arena->elem_size);
-	memcpy(buffer, elem1, arena->elem_size);
-	memcpy(elem1, elem2, arena->elem_size);
-	memcpy(elem2, buffer, arena->elem_size);
-	int release = ArenaRelease(scratch);
-	assert(release == 0);
+static int ArenaWriteAll(int fd, const void* buf, size_t len) {
+	const char* p = (const char*)buf;
+	while (len > 0) {
+		ssize_t n = write(fd, p, len);
+		if (n < 0) {
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
 }
 
-void ArenaDefrag (Arena* arena) {
-	assert(arena->elem_size >= arena->alignment);
-	assert(arena->one_type == true);
-	if (!arena->to_free) {
-		return;
+static int ArenaReadAll(int fd, void* buf, size_t len) {
+	char* p = (char*)buf;
+	while (len > 0) {
+		ssize_t n = read(fd, p, len);
+		if (n <= 0) {
+			return -1;
+		}
+		p += n;
+		len -= n;
 	}
-	Arena* scratch = ArenaAlloc((arena->elem_size + getpagesize() -1) / getpagesize() + 1);
-	scratch->one_type = true;
-	scratch->elem_size = arena->elem_size;
-	assert(scratch != NULL);
-	while (arena->to_free) {
-		void* ptr = (void*)(arena->ptr - arena->elem_size);
-		void* buffer = ArenaPush(scratch, arena->elem_size);
-		memcpy(buffer, ptr, arena->elem_size);
-		ArenaPop(arena, ptr);
-		void* newptr = ArenaPush(arena, arena->elem_size);
-		memcpy(newptr, buffer, arena->elem_size);
-		ArenaPop(scratch, buffer);
+	return 0;
+}
+
+//writes the used part of the arena to path so it can be reloaded with ArenaLoad. Holes tracked by the free_list or occupancy bitmap of a single type Arena are not saved, ArenaDefrag() first if that matters. Scratch pushed with ArenaPushHigh is not saved either
+int ArenaSave(Arena* arena, const char* path) {
+	if (!arena || !path) {
+		return -1;
 	}
-	ArenaRelease(scratch);
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		perror("couldn't open arena image");
+		return -1;
+	}
+	Arena header = *arena;
+	header.magic = ARENA_IMAGE_MAGIC;
+	header.free_list = NULL;
+	header.to_free = NULL;
+	header.dirty = NULL;
+	header.occupancy = NULL;
+	header.holes = 0;
+	header.handles = NULL;
+	header.high_ptr = header.end_ptr;
+	header.owned = false;
+	header.remote_free = NULL;
+	header.cleanups = NULL;
+	header.parent = NULL;
+	header.children = 0;
+	header.stats = NULL;
+	header.fd = -1;
+	header.cow = false;
+	int res = ArenaWriteAll(fd, &header, sizeof(Arena));
+	if (res == 0) {
+		res = ArenaWriteAll(fd, (void*)arena->first_ptr, arena->ptr - arena->first_ptr);
+	}
+	if (close(fd) != 0) {
+		res = -1;
+	}
+	return res;
+}
 
+//reloads an image written by ArenaSave at the address it was saved from, so raw pointers inside it are valid again. If that address is taken and relocated is NULL this fails and returns NULL. Otherwise the arena is mapped wherever there is room and *relocated is set to how far it moved (0 when it landed at its old base), so the caller can patch its own pointers
+Arena* ArenaLoad(const char* path, ptrdiff_t* relocated) {
+	long page_size = getpagesize();
+	int fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		perror("couldn't open arena image");
+		return NULL;
+	}
+	Arena header;
+	if (ArenaReadAll(fd, &header, sizeof(Arena)) != 0 || header.magic != ARENA_IMAGE_MAGIC ||
+		header.size % page_size != 0 || header.first_ptr < header.base || header.ptr < header.first_ptr ||
+		header.ptr > header.base + header.size) {
+		fprintf(stderr, "%s is not an arena image\n", path);
+		close(fd);
+		return NULL;
+	}
+	size_t alloc = header.size + page_size;
+	Arena* arena = ArenaMapAt((void*)header.base, alloc);
+	if (!arena) {
+		if (!relocated) {
+			fprintf(stderr, "ArenaLoad() address %p for %s is already in use\n", (void*)header.base, path);
+			close(fd);
+			return NULL;
+		}
+		arena = (Arena*) mmap(NULL, alloc, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (arena == (Arena*)MAP_FAILED) {
+			perror("couldn't allocate arena");
+			close(fd);
+			return NULL;
+		}
+	}
+	void* first = (void*)((uintptr_t)arena + (header.first_ptr - header.base));
+	if (ArenaReadAll(fd, first, header.ptr - header.first_ptr) != 0) {
+		fprintf(stderr, "%s is truncated\n", path);
+		close(fd);
+		munmap(arena, alloc);
+		return NULL;
+	}
+	close(fd);
+	*arena = header;
+	arena->magic = 0;
+	if (relocated) {
+		*relocated = (ptrdiff_t)((uintptr_t)arena - header.base);
+	}
+	ArenaRebase(arena);
+	if(mprotect((void*)(arena->end_ptr), page_size, PROT_NONE) != 0){
+		munmap(arena, alloc);
+		return NULL;
+	}
+	ArenaRegister(arena);
+	return arena;
+}
+
+//allocates an arena backed by an anonymous memfd instead of plain anonymous memory. memfd arenas can be cloned and snapshotted cheaply with ArenaClone and ArenaSnapshot
+Arena* ArenaAllocMemfd(unsigned pages) {
+	long page_size = getpagesize();
+	size_t alloc = ((size_t)pages + 1) * page_size;
+	int fd = memfd_create("arena", MFD_CLOEXEC);
+	if (fd == -1) {
+		perror("couldn't create arena memfd");
+		return NULL;
+	}
+	if (ftruncate(fd, alloc) != 0) {
+		perror("couldn't size arena memfd");
+		close(fd);
+		return NULL;
+	}
+	Arena* arena = (Arena*) mmap(NULL, alloc, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (arena == (Arena*)MAP_FAILED) {
+		perror("couldn't map arena memfd");
+		close(fd);
+		return NULL;
+	}
+	ArenaInit(arena, alloc - page_size);
+	arena->fd = fd;
+	if(mprotect((void*)(arena->end_ptr), page_size, PROT_NONE) != 0){
+		ArenaRelease(arena);
+		return NULL;
+	}
+	ArenaRegister(arena);
+	return arena;
+}
+
+//copies the free_list of src into a new free_list for the arena dst, moving every hole by the distance between the two arenas
+static Arena* ArenaCopyFreeList(Arena* src, Arena* dst) {
+	Arena* from = src->free_list;
+	Arena* to = ArenaAllocSide(from->size / getpagesize());
+	to->one_type = true;
+	to->elem_size = from->elem_size;
+	ArenaSetAlignment(to, from->alignment);
+	uintptr_t delta = (uintptr_t)dst - (uintptr_t)src;
+	size_t count = (from->ptr - from->first_ptr) / sizeof(void*);
+	void** in = (void**)from->first_ptr;
+	void** out = count ? (void**)ArenaPush(to, count * sizeof(void*)) : NULL;
+	for (size_t i = 0; i < count; i++) {
+		out[i] = (void*)((uintptr_t)in[i] + delta);
+	}
+	dst->free_list = to;
+	dst->to_free = src->to_free ? (void**)(to->first_ptr + ((uintptr_t)src->to_free - from->first_ptr)) : NULL;
+	return to;
+}
+
+//copies an arena holding position independent bookkeeping, like a bitmap, into a new arena of the same size
+static Arena* ArenaCopySide(Arena* from) {
+	Arena* to = ArenaAllocSide(from->size / getpagesize());
+	size_t bytes = from->ptr - from->first_ptr;
+	if (bytes) {
+		memcpy(ArenaPush(to, bytes), (void*)from->first_ptr, bytes);
+	}
+	return to;
+}
+
+//freezes the current contents of a memfd arena in its memfd and returns a private copy-on-write mapping of it. The source is moved onto a private mapping of the same memfd too, at the same address, so neither side sees the other's writes and only the pages someone writes to get copied. If the source was already forked its memfd is stale, so its used bytes at both ends are copied into a fresh memfd first
+static Arena* ArenaFork(Arena* arena, bool writable) {
+	assert(arena->fd >= 0);
+	long page_size = getpagesize();
+	size_t alloc = arena->size + page_size;
+	if (arena->cow) {
+		int fd = memfd_create("arena", MFD_CLOEXEC);
+		if (fd == -1) {
+			perror("couldn't create arena memfd");
+			return NULL;
+		}
+		size_t high = arena->high_ptr - (uintptr_t)arena;
+		if (ftruncate(fd, alloc) != 0 || ArenaWriteAll(fd, arena, arena->ptr - (uintptr_t)arena) != 0 ||
+			lseek(fd, high, SEEK_SET) == -1 || ArenaWriteAll(fd, (void*)arena->high_ptr, arena->size - high) != 0) {
+			perror("couldn't copy arena into a new memfd");
+			close(fd);
+			return NULL;
+		}
+		close(arena->fd);
+		arena->fd = fd;
+	}
+	int fd = arena->fd;
+	if (mmap(arena, alloc, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) != (void*)arena) {
+		perror("couldn't remap arena");
+		exit(EXIT_FAILURE);
+	}
+	//the header just mapped in is the copy written to the memfd, which can still hold the previous fd
+	arena->fd = fd;
+	arena->cow = true;
+	if(mprotect((void*)(arena->end_ptr), page_size, PROT_NONE) != 0){
+		return NULL;
+	}
+	//the new mapping is writable everywhere, so write fault tracking has to be set up again
+	if (arena->dirty && arena_dirty_mode == ARENA_DIRTY_MPROTECT) {
+		mprotect(arena, arena->size, PROT_READ);
+	}
+	int child_fd = dup(fd);
+	if (child_fd == -1) {
+		perror("couldn't dup arena memfd");
+		return NULL;
+	}
+	Arena* child = (Arena*) mmap(NULL, alloc, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if (child == (Arena*)MAP_FAILED) {
+		perror("couldn't map arena clone");
+		close(child_fd);
+		return NULL;
+	}
+	ArenaRebase(child);
+	child->fd = child_fd;
+	child->cow = true;
+	if (writable && arena->free_list) {
+		ArenaCopyFreeList(arena, child);
+	}
+	if (writable && arena->occupancy) {
+		child->occupancy = ArenaCopySide(arena->occupancy);
+		child->holes = arena->holes;
+		child->hole_hint = arena->hole_hint;
+	}
+	if (writable && arena->handles) {
+		child->handles = ArenaCopySide(arena->handles);
+	}
+	if(mprotect((void*)(child->end_ptr), page_size, PROT_NONE) != 0 ||
+		(!writable && mprotect(child, child->size, PROT_READ) != 0)){
+		ArenaRelease(child);
+		return NULL;
+	}
+	ArenaRegister(child);
+	return child;
+}
+
+//returns a writable copy of a memfd arena that shares all pages with the source until either side writes to them. The copy can be thrown away with ArenaRelease at any point
+Arena* ArenaClone(Arena* arena) {
+	return ArenaFork(arena, true);
+}
+
+//returns a read only view of a memfd arena as it is right now. Later writes to the source are not visible through the snapshot
+Arena* ArenaSnapshot(Arena* arena) {
+	return ArenaFork(arena, false);
+}
+
+//returns -1 if the alignment specified is not possible
+int ArenaSetAlignment(Arena* arena, size_t new_alignment) {
+	assert(arena->ptr < arena->end_ptr);
+	assert(new_alignment != 0);
+	//check if new_alignment is not a power of 2
+	if ((new_alignment & (new_alignment - 1)) != 0) {
+		return -1;
+	}
+	arena->alignment = new_alignment;
+	arena->ptr = (arena->ptr + arena->alignment -1) & ~(arena->alignment -1);
+	arena->first_ptr = (arena->first_ptr + arena->alignment -1) & ~(arena->alignment -1);
+	return 0;
+}
+
+
+void ArenaDrop (Arena* arena, void* ptr); 
+void ArenaDropRemote(Arena* arena, void* ptr);
+static void ArenaDrainRemote(Arena* arena);
+
+//size of one slot in a single type Arena, the element size rounded up to the alignment
+static size_t ArenaSlotSize(Arena* arena) {
+	return (arena->elem_size + arena->alignment - 1) & ~(arena->alignment - 1);
+}
+
+//index of the first word in [from, to) with a zero bit in it, or to if they are all full
+static size_t ArenaFirstNonFullWord(const uint64_t* words, size_t from, size_t to) {
+	size_t i = from;
+#ifdef __SSE2__
+	const __m128i full = _mm_set1_epi32(-1);
+	for (; i + 4 <= to; i += 4) {
+		__m128i both = _mm_and_si128(_mm_loadu_si128((const __m128i*)&words[i]), _mm_loadu_si128((const __m128i*)&words[i + 2]));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(both, full)) != 0xFFFF) {
+			break;
+		}
+	}
+#endif
+	while (i < to && words[i] == UINT64_MAX) {
+		i++;
+	}
+	return i;
+}
+
+//fills the lowest hole of an Arena that tracks occupancy and returns it. There must be at least one hole
+static void* ArenaTakeHole(Arena* arena) {
+	assert(arena->holes > 0);
+	size_t slot = ArenaSlotSize(arena);
+	uint64_t* bits = (uint64_t*)arena->occupancy->first_ptr;
+	size_t top = (arena->ptr - arena->first_ptr) / slot;
+	size_t word = ArenaFirstNonFullWord(bits, arena->hole_hint, (top + 63) / 64);
+	size_t index = word * 64 + __builtin_ctzll(~bits[word]);
+	assert(index < top);
+	bits[word] |= 1ULL << (index % 64);
+	arena->hole_hint = word;
+	arena->holes--;
+	return (void*)(arena->first_ptr + index * slot);
+}
+
+static ArenaHandleTable* ArenaHandleTableOf(Arena* arena) {
+	return (ArenaHandleTable*)arena->handles->first_ptr;
+}
+
+static ArenaHandleEntry* ArenaHandleEntries(ArenaHandleTable* table) {
+	return (ArenaHandleEntry*)(table + 1);
+}
+
+static uint32_t* ArenaHandleOwners(ArenaHandleTable* table) {
+	return (uint32_t*)(ArenaHandleEntries(table) + table->capacity);
+}
+
+//moves the handle of the element in slot from to slot to, if it has one
+static void ArenaMoveHandle(Arena* arena, size_t from, size_t to) {
+	if (!arena->handles) {
+		return;
+	}
+	ArenaHandleTable* table = ArenaHandleTableOf(arena);
+	uint32_t* owners = ArenaHandleOwners(table);
+	uint32_t handle = owners[from];
+	owners[to] = handle;
+	owners[from] = ARENA_NO_HANDLE;
+	if (handle != ARENA_NO_HANDLE) {
+		ArenaHandleEntries(table)[handle].slot = to;
+	}
+}
+
+//makes every handle to the element in slot stale and puts its entry back on the free chain
+static void ArenaForgetHandle(Arena* arena, size_t slot) {
+	if (!arena->handles) {
+		return;
+	}
+	ArenaHandleTable* table = ArenaHandleTableOf(arena);
+	uint32_t* owners = ArenaHandleOwners(table);
+	uint32_t handle = owners[slot];
+	if (handle == ARENA_NO_HANDLE) {
+		return;
+	}
+	ArenaHandleEntry* entry = &ArenaHandleEntries(table)[handle];
+	entry->generation++;
+	entry->slot = table->free_head;
+	table->free_head = handle;
+	owners[slot] = ARENA_NO_HANDLE;
+}
+
+//clears the occupancy bit of a live slot. If it was the top slot, ptr moves down past it and any holes right under it
+static void ArenaDropSlot(Arena* arena, void* ptr) {
+	size_t slot = ArenaSlotSize(arena);
+	uint64_t* bits = (uint64_t*)arena->occupancy->first_ptr;
+	assert((uintptr_t)ptr >= arena->first_ptr && (uintptr_t)ptr < arena->ptr);
+	assert(((uintptr_t)ptr - arena->first_ptr) % slot == 0);
+	size_t index = ((uintptr_t)ptr - arena->first_ptr) / slot;
+	size_t top = (arena->ptr - arena->first_ptr) / slot;
+	//catches dropping the same element twice
+	assert(bits[index / 64] & (1ULL << (index % 64)));
+	bits[index / 64] &= ~(1ULL << (index % 64));
+	ArenaForgetHandle(arena, index);
+	if (index == top - 1) {
+		top--;
+		while (top > 0 && !(bits[(top - 1) / 64] & (1ULL << ((top - 1) % 64)))) {
+			top--;
+			arena->holes--;
+		}
+		arena->ptr = arena->first_ptr + top * slot;
+	} else {
+		arena->holes++;
+		if (index / 64 < arena->hole_hint) {
+			arena->hole_hint = index / 64;
+		}
+	}
+}
+
+//clears the occupancy bits from the current ptr up to the old top slot after ArenaDropTo, then trims holes under the new top and recounts the rest
+static void ArenaCutOccupancy(Arena* arena, size_t old_top) {
+	size_t slot = ArenaSlotSize(arena);
+	uint64_t* bits = (uint64_t*)arena->occupancy->first_ptr;
+	size_t top = (arena->ptr - arena->first_ptr + slot - 1) / slot;
+	for (size_t index = top; index < old_top; index++) {
+		if (bits[index / 64] & (1ULL << (index % 64))) {
+			ArenaForgetHandle(arena, index);
+		}
+		bits[index / 64] &= ~(1ULL << (index % 64));
+	}
+	while (top > 0 && !(bits[(top - 1) / 64] & (1ULL << ((top - 1) % 64)))) {
+		top--;
+	}
+	arena->ptr = arena->first_ptr + top * slot;
+	size_t live = 0;
+	for (size_t word = 0; word < (top + 63) / 64; word++) {
+		live += __builtin_popcountll(bits[word]);
+	}
+	arena->holes = top - live;
+	arena->hole_hint = 0;
+}
+
+//stores the bytes used by an arena with published stats and raises the high water mark. Used bytes are both ends of the arena less the holes left by ArenaDrop. pushed is 1 for a push and 0 for anything else that moves ptr, high_ptr or the holes
+static void ArenaStatsUpdate(Arena* arena, uint64_t pushed) {
+	ArenaStats* stats = arena->stats;
+	uint64_t used = (arena->ptr - arena->first_ptr) + (arena->end_ptr - arena->high_ptr);
+	if (arena->one_type && arena->elem_size) {
+		uint64_t holes = arena->occupancy ? arena->holes : arena->free_list ? (arena->free_list->ptr - arena->free_list->first_ptr) / sizeof(void*) : 0;
+		used -= holes * ArenaSlotSize(arena);
+	}
+	__atomic_store_n(&stats->used, used, __ATOMIC_RELAXED);
+	if (used > stats->high_water) {
+		__atomic_store_n(&stats->high_water, used, __ATOMIC_RELAXED);
+	}
+	__atomic_store_n(&stats->pushes, stats->pushes + pushed, __ATOMIC_RELAXED);
+}
+
+static void ArenaStatsFailed(Arena* arena) {
+	__atomic_store_n(&arena->stats->failures, arena->stats->failures + 1, __ATOMIC_RELAXED);
+}
+
+//pushes a new element to the Arena. If the Arena is of a single type and ArenaPop was called, it will insert the newest element into the last hole left by ArenaDrop()
+void* ArenaPush(Arena* arena, size_t size) {
+	assert(arena->ptr < arena->end_ptr);
+	if (!arena || size == 0 || (arena->ptr + size + arena->alignment) >=  arena->high_ptr){
+		if (arena && arena->stats) {
+			ArenaStatsFailed(arena);
+		}
+		fprintf(stderr, "Something went wrong with the ArenaPush().\n arena = %p\n size to push = %ld\n arena->alignment = %ld\n arena->ptr = %ld\n arena->high_ptr = %ld\n", arena, size, arena->alignment, arena->ptr, arena->high_ptr);
+		return NULL;
+	}
+	void* newptr;
+	newptr = NULL;
+	//only an owned arena gets remote drops, and the owner takes them once it has no holes of its own left
+	if (!arena->to_free && !arena->holes && __atomic_load_n(&arena->remote_free, __ATOMIC_RELAXED)) {
+		ArenaDrainRemote(arena);
+	}
+	//reuse a free spot if one is available
+		if (arena->occupancy) {
+			if (arena->holes) {
+				newptr = ArenaTakeHole(arena);
+			} else {
+				newptr = (void*) arena->ptr;
+				size_t index = (arena->ptr - arena->first_ptr) / ArenaSlotSize(arena);
+				((uint64_t*)arena->occupancy->first_ptr)[index / 64] |= 1ULL << (index % 64);
+				arena->ptr = (arena->ptr + size + (arena->alignment -1)) & ~(arena->alignment -1);
+			}
+			memset(newptr, 0, arena->elem_size);
+		} else if (arena->free_list && arena->to_free && arena->one_type){
+			//if a free list exists, it must already be of one_type unless something went horribly wrong
+			assert(arena->one_type == true);
+			assert(arena->elem_size > 0);
+			newptr = *arena->to_free; 
+			memset(newptr, 0, arena->elem_size);
+			ArenaDrop(arena->free_list, arena->to_free);
+			if (arena->free_list->first_ptr == arena->free_list->ptr) {
+				//we are at the end (or start, depending on how you look at it) of the free_list
+				arena->to_free = NULL;
+			} else {
+				//the next hole is the one now on top of the free_list
+				arena->to_free = (void**) (arena->free_list->ptr - sizeof(void*));
+			}
+		} else {
+			newptr = (void*) arena->ptr;
+			arena->to_free = NULL;
+			arena->ptr = (arena->ptr + size + (arena->alignment -1)) & ~(arena->alignment -1);
+			if (arena->one_type) {
+				memset(newptr, 0, arena->elem_size);
+			}
+		}
+		//if the size of the push is not aligned with the arena, this aligns the pointer
+
+	if (arena->ptr > arena->touch_at) {
+		ArenaTouchAhead(arena);
+	}
+	if (arena->stats) {
+		ArenaStatsUpdate(arena, 1);
+	}
+	return newptr;
+}
+
+
+
+void ArenaDropTo (Arena* arena, void* pos) {
+	//the top end starts at high_ptr, so pos can't be past it or ptr would end up inside the ArenaPushHigh scratch
+	if (!arena || !pos || 
+		(uintptr_t)pos > arena->high_ptr || 
+		(uintptr_t)pos < arena->first_ptr) {
+		fprintf(stderr,"Something went wrong calling ArenaDropTo() arena = %p\n ArenaPopTo position = %p\n arena->high_ptr = %ld \n", arena, pos, arena ? arena->high_ptr : 0);
+		return;
+	}
+	assert(arena->ptr < arena->end_ptr);
+
+	//finalizers of everything that ends above pos, newest first. The record sits right after its object, so this also catches an object pos points into
+	while ((uintptr_t)arena->cleanups >= (uintptr_t)pos) {
+		ArenaCleanup* cleanup = arena->cleanups;
+		arena->cleanups = cleanup->next;
+		cleanup->fn(cleanup->obj);
+	}
+	size_t old_top = arena->occupancy ? (arena->ptr - arena->first_ptr) / ArenaSlotSize(arena) : 0;
+	arena->ptr = ((uintptr_t)pos + arena->alignment -1) & ~(arena->alignment -1);
+	if (arena->occupancy) {
+		ArenaCutOccupancy(arena, old_top);
+	}
+	if (arena->stats) {
+		ArenaStatsUpdate(arena, 0);
+	}
+}
+
+//pushes size bytes aligned to align, which has to be a power of 2, without touching the alignment of the arena. Padding is only added when ptr isn't aligned to align already, and alignments up to the arena's own never need any
+void* ArenaPushAligned(Arena* arena, size_t size, size_t align) {
+	assert(align != 0 && (align & (align - 1)) == 0);
+	//a single type Arena hands out holes of elem_size, whatever size was asked for
+	if (arena->one_type) {
+		fprintf(stderr, "Something went wrong with the ArenaPushAligned().\n arena = %p is a single type Arena\n", arena);
+		return NULL;
+	}
+	if (align <= arena->alignment) {
+		return ArenaPush(arena, size);
+	}
+	uintptr_t start = (arena->ptr + align - 1) & ~(uintptr_t)(align - 1);
+	if (size == 0 || start + size + arena->alignment >= arena->high_ptr) {
+		if (arena->stats) {
+			ArenaStatsFailed(arena);
+		}
+		fprintf(stderr, "Something went wrong with the ArenaPushAligned().\n arena = %p\n size to push = %ld\n align = %ld\n arena->ptr = %ld\n arena->high_ptr = %ld\n", arena, size, align, arena->ptr, arena->high_ptr);
+		return NULL;
+	}
+	arena->ptr = (start + size + (arena->alignment -1)) & ~(arena->alignment -1);
+	if (arena->ptr > arena->touch_at) {
+		ArenaTouchAhead(arena);
+	}
+	if (arena->stats) {
+		ArenaStatsUpdate(arena, 1);
+	}
+	return (void*)start;
+}
+
+//pushes room for one T, aligned for T
+#define ArenaPushStruct(arena, T) ((T*)ArenaPushAligned((arena), sizeof(T), alignof(T)))
+//pushes room for count elements of type T, aligned for T
+#define ArenaPushArray(arena, T, count) ((T*)ArenaPushAligned((arena), sizeof(T) * (count), alignof(T)))
+
+//like ArenaPushWithCleanup, with the object aligned to align like ArenaPushAligned, for over-aligned objects that need a finalizer
+void* ArenaPushAlignedWithCleanup(Arena* arena, size_t size, size_t align, ArenaCleanupFn fn) {
+	assert(arena->one_type == false);
+	size_t offset = (size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+	char* obj = (char*)ArenaPushAligned(arena, offset + sizeof(ArenaCleanup), align);
+	if (!obj) {
+		return NULL;
+	}
+	ArenaCleanup* cleanup = (ArenaCleanup*)(obj + offset);
+	cleanup->fn = fn;
+	cleanup->obj = obj;
+	cleanup->next = arena->cleanups;
+	arena->cleanups = cleanup;
+	return obj;
+}
+
+//pushes size bytes like ArenaPush and registers fn to be called with them when they are dropped with ArenaDropTo or the arena is released, newest first. For objects that own something outside the arena, like an fd, a lock or a malloc'd buffer. The record is kept in the arena right after the object
+void* ArenaPushWithCleanup(Arena* arena, size_t size, ArenaCleanupFn fn) {
+	return ArenaPushAlignedWithCleanup(arena, size, arena->alignment, fn);
+}
+
+//pushes scratch space onto the top end of the Arena, growing down from end_ptr. Both ends share the same pages, so this fails and returns NULL instead of running into the elements pushed with ArenaPush
+void* ArenaPushHigh(Arena* arena, size_t size) {
+	if (!arena || size == 0 || size > arena->high_ptr - arena->ptr ||
+		((arena->high_ptr - size) & ~(arena->alignment -1)) < arena->ptr) {
+		fprintf(stderr, "Something went wrong with the ArenaPushHigh().\n arena = %p\n size to push = %ld\n arena->ptr = %ld\n arena->high_ptr = %ld\n", arena, size, arena ? arena->ptr : 0, arena ? arena->high_ptr : 0);
+		return NULL;
+	}
+	arena->high_ptr = (arena->high_ptr - size) & ~(arena->alignment -1);
+	if (arena->stats) {
+		ArenaStatsUpdate(arena, 1);
+	}
+	return (void*) arena->high_ptr;
+}
+
+//drops everything pushed with ArenaPushHigh below pos. pos is a value high_ptr had earlier, saved before a batch of scratch pushes, or end_ptr to empty the top end
+void ArenaDropToHigh(Arena* arena, void* pos) {
+	if (!arena || (uintptr_t)pos < arena->high_ptr || (uintptr_t)pos > arena->end_ptr) {
+		fprintf(stderr,"Something went wrong calling ArenaDropToHigh() arena = %p\n position = %p\n arena->end_ptr = %ld \n", arena, pos, arena ? arena->end_ptr : 0);
+		return;
+	}
+	arena->high_ptr = (uintptr_t)pos;
+	if (arena->stats) {
+		ArenaStatsUpdate(arena, 0);
+	}
+}
+
+//this function only works for Arenas of a single type where the element size is the same size or larger than the alignment. It will "free" the location in memory provided by the pointer and add that address to the free list so that ArenaPush can use it next time
+void ArenaDrop (Arena* arena, void* ptr) {
+	assert(arena->one_type == true);
+	assert(arena->elem_size > 0);
+	//the rest of the header belongs to the owner thread
+	if (arena->owned && !pthread_equal(arena->owner, pthread_self())) {
+		ArenaDropRemote(arena, ptr);
+		return;
+	}
+	assert(arena->ptr < arena->end_ptr);
+	assert(arena->ptr >= arena->first_ptr);
+	assert(arena->elem_size >= arena->alignment);
+
+	if( arena->ptr == arena->first_ptr) {
+		fprintf(stderr, "Tried to ArenaDrop() on an Arena that hasn't had anything added to it or has been ArenaPopTo()'d the start of the Arena\n");
+		arena->to_free = NULL;
+		ArenaReleaseSide(&arena->free_list);
+		return;
+	}
+
+	if (arena->occupancy) {
+		ArenaDropSlot(arena, ptr);
+		if (arena->stats) {
+			ArenaStatsUpdate(arena, 0);
+		}
+		return;
+	}
+	
+	//if ptr is the top element in the Arena stack, just ArenaDropTo() the ptr
+	if ((((arena->ptr - arena->elem_size) + arena->alignment -1) & ~(arena->alignment -1) ) == (((uintptr_t)ptr + arena->alignment -1) & ~(arena->alignment -1))) {
+		ArenaDropTo(arena, ptr);
+	} else {
+		//if there is no free_list, make one
+		if (!(arena->free_list)) {
+			arena->free_list = ArenaAllocSide(((arena->size / arena->elem_size) * sizeof(void*) + getpagesize() -1) / getpagesize() + 1);
+			arena->free_list->one_type = true;
+			arena->free_list->elem_size = sizeof(void*);
+			ArenaSetAlignment(arena->free_list, sizeof(void*));
+		}
+		//this is just in case the free_list ArenaAllocSide() fails
+		assert(arena->free_list != NULL);
+		arena->to_free = (void**)ArenaPush(arena->free_list, sizeof(void*));
+		if(arena->to_free){
+			*(arena->to_free) = ptr;
+		} else {
+			fprintf(stderr, "Failed to set up void** to_free for Arena\n");
+		}
+		if (arena->stats) {
+			ArenaStatsUpdate(arena, 0);
+		}
+	}
+}
+
+//Just like ArenaDrop, but 0's the memory indicated by the ptr. The memory is cleared first since a dropped slot can be handed out again straight away by the owner of the arena
+void ArenaPop (Arena* arena, void* ptr) {
+	memset(ptr, 0, arena->elem_size);
+	ArenaDrop(arena, ptr);
+}
+
+//makes the calling thread the owner of a single type Arena. From then on only the owner may push, and ArenaDrop from other threads is turned into ArenaDropRemote, so objects can be freed by a different thread than the one that allocated them. The owner's own pushes and drops stay free of atomics
+void ArenaSetOwner(Arena* arena) {
+	assert(arena->one_type == true);
+	assert(arena->elem_size >= sizeof(void*));
+	arena->owner = pthread_self();
+	arena->owned = true;
+}
+
+//drops an element of an owned single type Arena from a thread that is not its owner. The slot is linked onto remote_free and only reused after the owner drains it
+void ArenaDropRemote(Arena* arena, void* ptr) {
+	void* head = __atomic_load_n(&arena->remote_free, __ATOMIC_RELAXED);
+	do {
+		*(void**)ptr = head;
+	} while (!__atomic_compare_exchange_n(&arena->remote_free, &head, ptr, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+//takes every slot dropped by other threads and drops it locally, which puts it in the free_list or occupancy bitmap like any other hole. Everything that walks or counts the slots calls this first, a remote drop is only a link in the dead element until then
+static void ArenaDrainRemote(Arena* arena) {
+	void* slot = __atomic_exchange_n(&arena->remote_free, NULL, __ATOMIC_ACQUIRE);
+	while (slot) {
+		void* next = *(void**)slot;
+		ArenaDrop(arena, slot);
+		slot = next;
+	}
+}
+
+//swaps two elements of an Arena. Only works for Arenas of a single type
+void ArenaSwap(Arena* arena, void* elem1, void* elem2) {
+	assert(arena->one_type == true);
+	assert(arena->elem_size > 0);
+	Arena* scratch = ArenaScratch(arena->elem_size);
+	void* buffer = ArenaPush(scratch, arena->elem_size);
+	memcpy(buffer, elem1, arena->elem_size);
+	memcpy(elem1, elem2, arena->elem_size);
+	memcpy(elem2, buffer, arena->elem_size);
+	int release = ArenaRelease(scratch);
+	assert(release == 0);
+	if (arena->handles) {
+		size_t slot = ArenaSlotSize(arena);
+		size_t index1 = ((uintptr_t)elem1 - arena->first_ptr) / slot;
+		size_t index2 = ((uintptr_t)elem2 - arena->first_ptr) / slot;
+		ArenaHandleTable* table = ArenaHandleTableOf(arena);
+		uint32_t* owners = ArenaHandleOwners(table);
+		uint32_t handle1 = owners[index1];
+		uint32_t handle2 = owners[index2];
+		owners[index1] = handle2;
+		owners[index2] = handle1;
+		if (handle1 != ARENA_NO_HANDLE) {
+			ArenaHandleEntries(table)[handle1].slot = index2;
+		}
+		if (handle2 != ARENA_NO_HANDLE) {
+			ArenaHandleEntries(table)[handle2].slot = index1;
+		}
+	}
+}
+
+void ArenaDefrag (Arena* arena) {
+	assert(arena->elem_size >= arena->alignment);
+	assert(arena->one_type == true);
+	if (__atomic_load_n(&arena->remote_free, __ATOMIC_RELAXED)) {
+		ArenaDrainRemote(arena);
+	}
+	//with an occupancy bitmap the top element moves into the lowest hole until there are none left
+	if (arena->occupancy) {
+		size_t slot = ArenaSlotSize(arena);
+		while (arena->holes) {
+			void* hole = ArenaTakeHole(arena);
+			void* last = (void*)(arena->ptr - slot);
+			memcpy(hole, last, arena->elem_size);
+			ArenaMoveHandle(arena, ((uintptr_t)last - arena->first_ptr) / slot, ((uintptr_t)hole - arena->first_ptr) / slot);
+			ArenaDropSlot(arena, last);
+		}
+		if (arena->stats) {
+			ArenaStatsUpdate(arena, 0);
+		}
+		return;
+	}
+	if (!arena->to_free) {
+		return;
+	}
+	Arena* scratch = ArenaScratch(arena->elem_size);
+	scratch->one_type = true;
+	scratch->elem_size = arena->elem_size;
+	assert(scratch != NULL);
+	while (arena->to_free) {
+		void* ptr = (void*)(arena->ptr - arena->elem_size);
+		void* buffer = ArenaPush(scratch, arena->elem_size);
+		memcpy(buffer, ptr, arena->elem_size);
+		ArenaPop(arena, ptr);
+		void* newptr = ArenaPush(arena, arena->elem_size);
+		memcpy(newptr, buffer, arena->elem_size);
+		ArenaPop(scratch, buffer);
+	}
+	ArenaRelease(scratch);
+
+}
+
+//starts tracking which slots of a single type Arena hold live elements with a bitmap, one bit per slot. From then on ArenaPush fills the lowest hole first instead of the last one dropped, found with a word scan and a count of trailing zeros, and holes found in the free_list are moved into the bitmap. Returns -1 if the Arena is not of a single type
+int ArenaTrackOccupancy(Arena* arena) {
+	if (!arena || !arena->one_type || arena->elem_size < arena->alignment) {
+		return -1;
+	}
+	if (arena->occupancy) {
+		return 0;
+	}
+	long page_size = getpagesize();
+	size_t slot = ArenaSlotSize(arena);
+	size_t capacity = (arena->end_ptr - arena->first_ptr) / slot;
+	size_t bytes = ((capacity + 63) / 64) * sizeof(uint64_t);
+	Arena* occupancy = ArenaAllocSide((bytes + page_size - 1) / page_size + 1);
+	uint64_t* bits = (uint64_t*)ArenaPush(occupancy, bytes);
+	size_t top = (arena->ptr - arena->first_ptr) / slot;
+	for (size_t index = 0; index < top; index++) {
+		bits[index / 64] |= 1ULL << (index % 64);
+	}
+	if (arena->free_list) {
+		for (void** hole = (void**)arena->free_list->first_ptr; (uintptr_t)hole < arena->free_list->ptr; hole++) {
+			size_t index = ((uintptr_t)*hole - arena->first_ptr) / slot;
+			bits[index / 64] &= ~(1ULL << (index % 64));
+		}
+		ArenaReleaseSide(&arena->free_list);
+		arena->to_free = NULL;
+	}
+	arena->occupancy = occupancy;
+	ArenaCutOccupancy(arena, top);
+	return 0;
+}
+
+//number of live elements in a single type Arena. Counted with popcount when occupancy is tracked
+size_t ArenaLiveCount(Arena* arena) {
+	assert(arena->one_type == true);
+	if (__atomic_load_n(&arena->remote_free, __ATOMIC_RELAXED)) {
+		ArenaDrainRemote(arena);
+	}
+	size_t slot = ArenaSlotSize(arena);
+	size_t top = (arena->ptr - arena->first_ptr + slot - 1) / slot;
+	if (arena->occupancy) {
+		uint64_t* bits = (uint64_t*)arena->occupancy->first_ptr;
+		size_t live = 0;
+		for (size_t word = 0; word < (top + 63) / 64; word++) {
+			live += __builtin_popcountll(bits[word]);
+		}
+		return live;
+	}
+	size_t holes = arena->free_list ? (arena->free_list->ptr - arena->free_list->first_ptr) / sizeof(void*) : 0;
+	return top - holes;
+}
+
+//returns true if ptr is a live element of a single type Arena that tracks occupancy
+bool ArenaIsLive(Arena* arena, void* ptr) {
+	assert(arena->occupancy != NULL);
+	if ((uintptr_t)ptr < arena->first_ptr || (uintptr_t)ptr >= arena->ptr) {
+		return false;
+	}
+	size_t slot = ArenaSlotSize(arena);
+	size_t index = ((uintptr_t)ptr - arena->first_ptr) / slot;
+	uint64_t* bits = (uint64_t*)arena->occupancy->first_ptr;
+	return ((uintptr_t)ptr - arena->first_ptr) % slot == 0 && (bits[index / 64] & (1ULL << (index % 64)));
+}
+
+
+//checks whether the kernel keeps soft-dirty bits by clearing them, writing to a page and reading the bit back from pagemap
+static ArenaDirtyMode ArenaDetectDirtyMode(void) {
+	long page_size = getpagesize();
+	ArenaDirtyMode mode = ARENA_DIRTY_MPROTECT;
+	int clear = open("/proc/self/clear_refs", O_WRONLY);
+	int pagemap = open("/proc/self/pagemap", O_RDONLY);
+	char* page = (char*) mmap(NULL, page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (clear != -1 && pagemap != -1 && page != (char*)MAP_FAILED) {
+		page[0] = 1;
+		uint64_t entry = 0;
+		if (write(clear, "4", 1) == 1) {
+			page[0] = 2;
+			if (pread(pagemap, &entry, sizeof(entry), ((uintptr_t)page / page_size) * sizeof(entry)) == sizeof(entry) &&
+				(entry & (1ULL << 55))) {
+				mode = ARENA_DIRTY_SOFT;
+			}
+		}
+	}
+	if (page != (char*)MAP_FAILED) {
+		munmap(page, page_size);
+	}
+	if (clear != -1) {
+		close(clear);
+	}
+	if (pagemap != -1) {
+		close(pagemap);
+	}
+	return mode;
+}
+
+static struct sigaction arena_old_segv;
+
+//marks the faulting page of a tracked arena dirty and makes it writable. Faults anywhere else go to the handler that was installed before
+static void ArenaDirtyFault(int sig, siginfo_t* info, void* context) {
+	uintptr_t addr = (uintptr_t)info->si_addr;
+	long page_size = getpagesize();
+	for (int i = 0; i < ARENA_MAX_TRACKED; i++) {
+		Arena* arena = __atomic_load_n(&arena_tracked[i], __ATOMIC_ACQUIRE);
+		if (arena && addr >= (uintptr_t)arena && addr < (uintptr_t)arena + arena->size) {
+			size_t page = (addr - (uintptr_t)arena) / page_size;
+			uint64_t* bits = (uint64_t*)arena->dirty->first_ptr;
+			__atomic_fetch_or(&bits[page / 64], 1ULL << (page % 64), __ATOMIC_RELAXED);
+			mprotect((void*)(addr & ~(uintptr_t)(page_size - 1)), page_size, PROT_READ | PROT_WRITE);
+			return;
+		}
+	}
+	if (arena_old_segv.sa_flags & SA_SIGINFO) {
+		arena_old_segv.sa_sigaction(sig, info, context);
+	} else if (arena_old_segv.sa_handler == SIG_DFL || arena_old_segv.sa_handler == SIG_IGN) {
+		//returning re-runs the faulting instruction, which now gets the default action
+		signal(SIGSEGV, SIG_DFL);
+	} else {
+		arena_old_segv.sa_handler(sig);
+	}
+}
+
+//ORs the soft-dirty bits of every tracked arena into its dirty bitmap. Has to run before the bits are cleared since clear_refs works on the whole process
+static int ArenaHarvestSoftDirty(void) {
+	long page_size = getpagesize();
+	int pagemap = open("/proc/self/pagemap", O_RDONLY);
+	if (pagemap == -1) {
+		return -1;
+	}
+	uint64_t entries[512];
+	for (int i = 0; i < ARENA_MAX_TRACKED; i++) {
+		Arena* arena = arena_tracked[i];
+		if (!arena) {
+			continue;
+		}
+		uint64_t* bits = (uint64_t*)arena->dirty->first_ptr;
+		size_t pages = arena->size / page_size;
+		for (size_t start = 0; start < pages; start += 512) {
+			size_t count = pages - start < 512 ? pages - start : 512;
+			off_t at = (((uintptr_t)arena / page_size) + start) * sizeof(uint64_t);
+			if (pread(pagemap, entries, count * sizeof(uint64_t), at) != (ssize_t)(count * sizeof(uint64_t))) {
+				close(pagemap);
+				return -1;
+			}
+			for (size_t j = 0; j < count; j++) {
+				if (entries[j] & (1ULL << 55)) {
+					bits[(start + j) / 64] |= 1ULL << ((start + j) % 64);
+				}
+			}
+		}
+	}
+	close(pagemap);
+	int clear = open("/proc/self/clear_refs", O_WRONLY);
+	if (clear == -1) {
+		return -1;
+	}
+	int res = write(clear, "4", 1) == 1 ? 0 : -1;
+	close(clear);
+	return res;
+}
+
+//starts tracking which pages of the arena are written to, so ArenaCheckpoint only has to write those. Every page up to ptr counts as dirty at first, so the first checkpoint is a full image. Returns the mode used, or -1 if too many arenas are tracked. In ARENA_DIRTY_MPROTECT mode system calls that write into the arena, like read(), fail with EFAULT on pages that are clean
+int ArenaTrackDirty(Arena* arena) {
+	//a sub-arena shares its pages with the parent, so they can't be protected on their own
+	if (!arena || arena->parent) {
+		return -1;
+	}
+	if (arena->dirty) {
+		return arena_dirty_mode;
+	}
+	long page_size = getpagesize();
+	if (arena_dirty_mode == ARENA_DIRTY_NONE) {
+		arena_dirty_mode = ArenaDetectDirtyMode();
+		if (arena_dirty_mode == ARENA_DIRTY_MPROTECT) {
+			struct sigaction sa;
+			memset(&sa, 0, sizeof(sa));
+			sa.sa_sigaction = ArenaDirtyFault;
+			sa.sa_flags = SA_SIGINFO;
+			sigemptyset(&sa.sa_mask);
+			sigaction(SIGSEGV, &sa, &arena_old_segv);
+		}
+	}
+	int slot = -1;
+	for (int i = 0; i < ARENA_MAX_TRACKED && slot == -1; i++) {
+		if (!arena_tracked[i]) {
+			slot = i;
+		}
+	}
+	if (slot == -1) {
+		fprintf(stderr, "ArenaTrackDirty() can't track more than %d arenas\n", ARENA_MAX_TRACKED);
+		return -1;
+	}
+	size_t pages = arena->size / page_size;
+	size_t bytes = ((pages + 63) / 64) * sizeof(uint64_t);
+	Arena* dirty = ArenaAllocSide((bytes + page_size - 1) / page_size + 1);
+	uint64_t* bits = (uint64_t*)ArenaPush(dirty, bytes);
+	size_t used = (arena->ptr - (uintptr_t)arena + page_size - 1) / page_size;
+	for (size_t page = 0; page < used; page++) {
+		bits[page / 64] |= 1ULL << (page % 64);
+	}
+	arena->dirty = dirty;
+	__atomic_store_n(&arena_tracked[slot], arena, __ATOMIC_RELEASE);
+	if (arena_dirty_mode == ARENA_DIRTY_MPROTECT) {
+		mprotect(arena, arena->size, PROT_READ);
+	}
+	return arena_dirty_mode;
+}
+
+//stops tracking writes to the arena. Called by ArenaRelease
+void ArenaUntrackDirty(Arena* arena) {
+	if (!arena || !arena->dirty) {
+		return;
+	}
+	if (arena_dirty_mode == ARENA_DIRTY_MPROTECT) {
+		mprotect(arena, arena->size, PROT_READ | PROT_WRITE);
+	}
+	for (int i = 0; i < ARENA_MAX_TRACKED; i++) {
+		if (arena_tracked[i] == arena) {
+			__atomic_store_n(&arena_tracked[i], (Arena*)NULL, __ATOMIC_RELEASE);
+		}
+	}
+	ArenaReleaseSide(&arena->dirty);
+}
+
+//writes every page of the arena that changed since the last checkpoint to fd and starts tracking again from a clean state. The stream is a uint64_t magic and page size, then a uint64_t page index and the page contents for every dirty page, then UINT64_MAX. Page indexes count from the start of the arena's mapping, the layout of the file behind a file backed arena. Returns the number of pages written or -1
+long ArenaCheckpoint(Arena* arena, int fd) {
+	if (!arena || !arena->dirty) {
+		return -1;
+	}
+	long page_size = getpagesize();
+	if (arena_dirty_mode == ARENA_DIRTY_SOFT && ArenaHarvestSoftDirty() != 0) {
+		return -1;
+	}
+	uint64_t header[2] = {ARENA_DELTA_MAGIC, (uint64_t)page_size};
+	if (ArenaWriteAll(fd, header, sizeof(header)) != 0) {
+		return -1;
+	}
+	uint64_t* bits = (uint64_t*)arena->dirty->first_ptr;
+	size_t pages = arena->size / page_size;
+	long written = 0;
+	for (size_t word = 0; word < (pages + 63) / 64; word++) {
+		uint64_t set = __atomic_exchange_n(&bits[word], 0, __ATOMIC_RELAXED);
+		while (set) {
+			uint64_t page = word * 64 + __builtin_ctzll(set);
+			set &= set - 1;
+			void* addr = (void*)((uintptr_t)arena + page * page_size);
+			//protect the page before copying it, so a write that races with the copy marks it dirty again
+			if (arena_dirty_mode == ARENA_DIRTY_MPROTECT) {
+				mprotect(addr, page_size, PROT_READ);
+			}
+			if (ArenaWriteAll(fd, &page, sizeof(page)) != 0 || ArenaWriteAll(fd, addr, page_size) != 0) {
+				return -1;
+			}
+			written++;
+		}
+	}
+	uint64_t end = UINT64_MAX;
+	if (ArenaWriteAll(fd, &end, sizeof(end)) != 0) {
+		return -1;
+	}
+	return written;
+}
+
+//applies a checkpoint read from delta_fd to the image in image_fd by writing each page at its index. Returns the number of pages applied or -1
+long ArenaApplyCheckpoint(int delta_fd, int image_fd) {
+	uint64_t header[2];
+	if (ArenaReadAll(delta_fd, header, sizeof(header)) != 0 || header[0] != ARENA_DELTA_MAGIC || header[1] == 0) {
+		fprintf(stderr, "ArenaApplyCheckpoint() input is not an arena checkpoint\n");
+		return -1;
+	}
+	size_t page_size = header[1];
+	Arena* scratch = ArenaScratch(page_size);
+	void* buffer = ArenaPush(scratch, page_size);
+	long applied = 0;
+	for (;;) {
+		uint64_t page;
+		if (ArenaReadAll(delta_fd, &page, sizeof(page)) != 0) {
+			applied = -1;
+			break;
+		}
+		if (page == UINT64_MAX) {
+			break;
+		}
+		if (ArenaReadAll(delta_fd, buffer, page_size) != 0 ||
+			pwrite(image_fd, buffer, page_size, page * page_size) != (ssize_t)page_size) {
+			applied = -1;
+			break;
+		}
+		applied++;
+	}
+	ArenaRelease(scratch);
+	return applied;
+}
+
+//maps a shared memory arena from fd. If pages is not 0 the memory is sized and a new header is written, otherwise the existing header is checked
+static Arena* ArenaMapShared(int fd, unsigned pages) {
+	long page_size = getpagesize();
+	size_t alloc = ((size_t)pages + 1) * page_size;
+	if (pages) {
+		if (ftruncate(fd, alloc) != 0) {
+			perror("couldn't size shared arena");
+			return NULL;
+		}
+	} else {
+		struct stat st;
+		if (fstat(fd, &st) != 0) {
+			perror("couldn't stat shared arena");
+			return NULL;
+		}
+		alloc = st.st_size;
+		if (alloc % page_size != 0 || alloc < 2 * (size_t)page_size) {
+			fprintf(stderr, "ArenaAttachShared() fd %d is not a shared arena\n", fd);
+			return NULL;
+		}
+	}
+	Arena* arena = (Arena*) mmap(NULL, alloc, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (arena == (Arena*)MAP_FAILED) {
+		perror("couldn't map shared arena");
+		return NULL;
+	}
+	if (pages) {
+		ArenaInit(arena, alloc - page_size);
+		arena->shared_top = arena->first_ptr - (uintptr_t)arena;
+		__atomic_store_n(&arena->magic, ARENA_SHARED_MAGIC, __ATOMIC_RELEASE);
+	} else if (__atomic_load_n(&arena->magic, __ATOMIC_ACQUIRE) != ARENA_SHARED_MAGIC || arena->size != alloc - page_size) {
+		fprintf(stderr, "ArenaAttachShared() fd %d is not a shared arena\n", fd);
+		munmap(arena, alloc);
+		return NULL;
+	}
+	if(mprotect((void*)((uintptr_t)arena + arena->size), page_size, PROT_NONE) != 0){
+		munmap(arena, alloc);
+		return NULL;
+	}
+	ArenaRegister(arena);
+	return arena;
+}
+
+//creates an arena in shared memory that several processes can map and allocate from at once. With a name the memory comes from shm_open and other processes attach with ArenaAttachShared(name), without one it comes from a memfd and other processes attach with ArenaAttachSharedFd after inheriting or receiving the fd. If fd is not NULL the descriptor is returned there and the caller has to close it. The header is shared by every process, so its pointers only make sense to the creator: allocate with ArenaPushShared and pass ArenaOffset values between processes
+Arena* ArenaAllocShared(const char* name, unsigned pages, int* fd) {
+	int shm = name ? shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600) : memfd_create("arena", 0);
+	if (shm == -1) {
+		perror("couldn't create shared arena");
+		return NULL;
+	}
+	Arena* arena = ArenaMapShared(shm, pages ? pages : 1);
+	if (!arena && name) {
+		shm_unlink(name);
+	}
+	if (arena && fd) {
+		*fd = shm;
+	} else {
+		close(shm);
+	}
+	return arena;
+}
+
+//maps the shared memory arena created under name by ArenaAllocShared
+Arena* ArenaAttachShared(const char* name) {
+	int shm = shm_open(name, O_RDWR, 0);
+	if (shm == -1) {
+		perror("couldn't open shared arena");
+		return NULL;
+	}
+	Arena* arena = ArenaMapShared(shm, 0);
+	close(shm);
+	return arena;
+}
+
+//maps the shared memory arena behind fd. The caller keeps ownership of fd
+Arena* ArenaAttachSharedFd(int fd) {
+	return ArenaMapShared(fd, 0);
+}
+
+//removes the name of a shared memory arena. Processes that have it mapped keep using it until they ArenaRelease it
+int ArenaUnlinkShared(const char* name) {
+	return shm_unlink(name);
+}
+
+//allocates size bytes in a shared memory arena and returns their offset, or 0 if the arena is full. Safe to call from any number of threads and processes at once. Use ArenaOffsetPtr to get a pointer in the calling process
+ArenaOffset ArenaPushShared(Arena* arena, size_t size) {
+	assert(arena->magic == ARENA_SHARED_MAGIC);
+	ArenaOffset top = __atomic_load_n(&arena->shared_top, __ATOMIC_RELAXED);
+	ArenaOffset start;
+	ArenaOffset next;
+	do {
+		start = (top + arena->alignment - 1) & ~(arena->alignment - 1);
+		next = start + size;
+		if (size == 0 || next > arena->size) {
+			fprintf(stderr, "Something went wrong with the ArenaPushShared().\n arena = %p\n size to push = %ld\n shared_top = %ld\n arena->size = %ld\n", (void*)arena, size, top, arena->size);
+			return 0;
+		}
+	} while (!__atomic_compare_exchange_n(&arena->shared_top, &top, next, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	return start;
+}
+
+//returns the occupancy bits of a single type Arena. If it doesn't track occupancy the bits are built from the free_list in a new arena returned through scratch, which the caller releases
+static uint64_t* ArenaLiveBits(Arena* arena, Arena** scratch) {
+	*scratch = NULL;
+	if (arena->occupancy) {
+		return (uint64_t*)arena->occupancy->first_ptr;
+	}
+	size_t slot = ArenaSlotSize(arena);
+	size_t top = (arena->ptr - arena->first_ptr) / slot;
+	size_t bytes = ((top + 63) / 64 + 1) * sizeof(uint64_t);
+	*scratch = ArenaScratch(bytes);
+	uint64_t* bits = (uint64_t*)ArenaPush(*scratch, bytes);
+	for (size_t index = 0; index < top; index++) {
+		bits[index / 64] |= 1ULL << (index % 64);
+	}
+	if (arena->free_list) {
+		for (void** hole = (void**)arena->free_list->first_ptr; (uintptr_t)hole < arena->free_list->ptr; hole++) {
+			size_t index = ((uintptr_t)*hole - arena->first_ptr) / slot;
+			bits[index / 64] &= ~(1ULL << (index % 64));
+		}
+	}
+	return bits;
+}
+
+//hands a run of live slots to run, or every element in it to visit with the element ARENA_PREFETCH_AHEAD slots further on prefetched
+static void ArenaVisitRun(Arena* arena, size_t start, size_t length, ArenaRunFn run, ArenaVisitFn visit, void* ctx) {
+	size_t slot = ArenaSlotSize(arena);
+	if (run) {
+		run((void*)(arena->first_ptr + start * slot), length, ctx);
+		return;
+	}
+	for (size_t i = start; i < start + length; i++) {
+		__builtin_prefetch((void*)(arena->first_ptr + (i + ARENA_PREFETCH_AHEAD) * slot));
+		visit((void*)(arena->first_ptr + i * slot), ctx);
+	}
+}
+
+//finds the runs of live slots in [from, to) and passes them to ArenaVisitRun. Runs that cross a word boundary are joined
+static void ArenaVisitRange(Arena* arena, const uint64_t* bits, size_t from, size_t to, ArenaRunFn run, ArenaVisitFn visit, void* ctx) {
+	size_t run_start = 0;
+	size_t run_length = 0;
+	for (size_t word = from / 64; word * 64 < to; word++) {
+		uint64_t live = bits[word];
+		if (word * 64 < from) {
+			live &= UINT64_MAX << (from % 64);
+		}
+		if ((word + 1) * 64 > to) {
+			live &= (1ULL << (to % 64)) - 1;
+		}
+		size_t bit = 0;
+		while (bit < 64) {
+			uint64_t rest = live >> bit;
+			if (!rest) {
+				break;
+			}
+			size_t start = bit + __builtin_ctzll(rest);
+			rest = live >> start;
+			size_t length = ~rest ? (size_t)__builtin_ctzll(~rest) : 64 - start;
+			size_t index = word * 64 + start;
+			if (run_length && run_start + run_length == index) {
+				run_length += length;
+			} else {
+				if (run_length) {
+					ArenaVisitRun(arena, run_start, run_length, run, visit, ctx);
+				}
+				run_start = index;
+				run_length = length;
+			}
+			bit = start + length;
+		}
+	}
+	if (run_length) {
+		ArenaVisitRun(arena, run_start, run_length, run, visit, ctx);
+	}
+}
+
+//calls visit with every live element of a single type Arena in address order, skipping holes without touching them. Uses the occupancy bitmap if there is one, otherwise a temporary one is built from the free_list
+void ArenaForEach(Arena* arena, ArenaVisitFn visit, void* ctx) {
+	assert(arena->one_type == true);
+	if (__atomic_load_n(&arena->remote_free, __ATOMIC_RELAXED)) {
+		ArenaDrainRemote(arena);
+	}
+	Arena* scratch;
+	uint64_t* bits = ArenaLiveBits(arena, &scratch);
+	size_t top = (arena->ptr - arena->first_ptr) / ArenaSlotSize(arena);
+	ArenaVisitRange(arena, bits, 0, top, NULL, visit, ctx);
+	if (scratch) {
+		ArenaRelease(scratch);
+	}
+}
+
+//like ArenaForEach, but calls run once for every run of live elements that sit next to each other so they can be processed in batches
+void ArenaForEachRun(Arena* arena, ArenaRunFn run, void* ctx) {
+	assert(arena->one_type == true);
+	if (__atomic_load_n(&arena->remote_free, __ATOMIC_RELAXED)) {
+		ArenaDrainRemote(arena);
+	}
+	Arena* scratch;
+	uint64_t* bits = ArenaLiveBits(arena, &scratch);
+	size_t top = (arena->ptr - arena->first_ptr) / ArenaSlotSize(arena);
+	ArenaVisitRange(arena, bits, 0, top, run, NULL, ctx);
+	if (scratch) {
+		ArenaRelease(scratch);
+	}
+}
+
+typedef struct ArenaVisitJob {
+	Arena* arena;
+	const uint64_t* bits;
+	size_t from;
+	size_t to;
+	ArenaVisitFn visit;
+	void* ctx;
+} ArenaVisitJob;
+
+static void* ArenaVisitThread(void* arg) {
+	ArenaVisitJob* job = (ArenaVisitJob*)arg;
+	ArenaVisitRange(job->arena, job->bits, job->from, job->to, NULL, job->visit, job->ctx);
+	return NULL;
+}
+
+//like ArenaForEach, but splits the slots between threads on 64 slot boundaries and visits the parts at the same time, so visit has to be safe to call from several threads. threads = 0 uses one thread per online CPU. The Arena must not change until this returns
+void ArenaForEachParallel(Arena* arena, ArenaVisitFn visit, void* ctx, unsigned threads) {
+	assert(arena->one_type == true);
+	if (__atomic_load_n(&arena->remote_free, __ATOMIC_RELAXED)) {
+		ArenaDrainRemote(arena);
+	}
+	if (threads == 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cpus > 0 ? cpus : 1;
+	}
+	Arena* scratch;
+	uint64_t* bits = ArenaLiveBits(arena, &scratch);
+	size_t top = (arena->ptr - arena->first_ptr) / ArenaSlotSize(arena);
+	size_t words = (top + 63) / 64;
+	if (threads > words) {
+		threads = words ? words : 1;
+	}
+	size_t bytes = threads * (sizeof(ArenaVisitJob) + sizeof(pthread_t));
+	Arena* jobs_arena = ArenaScratch(bytes);
+	ArenaVisitJob* jobs = (ArenaVisitJob*)ArenaPush(jobs_arena, threads * sizeof(ArenaVisitJob));
+	pthread_t* ids = (pthread_t*)ArenaPush(jobs_arena, threads * sizeof(pthread_t));
+	size_t per_thread = (words + threads - 1) / threads;
+	for (unsigned i = 0; i < threads; i++) {
+		size_t from = i * per_thread * 64;
+		size_t to = (i + 1) * per_thread * 64;
+		jobs[i].arena = arena;
+		jobs[i].bits = bits;
+		jobs[i].from = from < top ? from : top;
+		jobs[i].to = to < top ? to : top;
+		jobs[i].visit = visit;
+		jobs[i].ctx = ctx;
+	}
+	//the calling thread takes the first part itself
+	for (unsigned i = 1; i < threads; i++) {
+		if (pthread_create(&ids[i], NULL, ArenaVisitThread, &jobs[i]) != 0) {
+			ArenaVisitThread(&jobs[i]);
+			ids[i] = 0;
+		}
+	}
+	ArenaVisitThread(&jobs[0]);
+	for (unsigned i = 1; i < threads; i++) {
+		if (ids[i]) {
+			pthread_join(ids[i], NULL);
+		}
+	}
+	ArenaRelease(jobs_arena);
+	if (scratch) {
+		ArenaRelease(scratch);
+	}
+}
+
+//sets up generational handles for a single type Arena, see ArenaPushHandle. The indirection table lives in its own arena. Occupancy tracking is turned on as well, since dropping an element has to find its handle. Returns -1 if the Arena is not of a single type
+int ArenaTrackHandles(Arena* arena) {
+	if (ArenaTrackOccupancy(arena) != 0) {
+		return -1;
+	}
+	if (arena->handles) {
+		return 0;
+	}
+	long page_size = getpagesize();
+	size_t capacity = (arena->end_ptr - arena->first_ptr) / ArenaSlotSize(arena);
+	assert(capacity < ARENA_NO_HANDLE);
+	size_t bytes = sizeof(ArenaHandleTable) + capacity * (sizeof(ArenaHandleEntry) + sizeof(uint32_t));
+	Arena* handles = ArenaAllocSide((bytes + page_size - 1) / page_size + 1);
+	ArenaHandleTable* table = (ArenaHandleTable*)ArenaPush(handles, bytes);
+	table->capacity = capacity;
+	table->free_head = ARENA_NO_HANDLE;
+	table->top = 0;
+	memset(ArenaHandleOwners(table), 0xff, capacity * sizeof(uint32_t));
+	arena->handles = handles;
+	return 0;
+}
+
+//pushes a new element like ArenaPush and returns a handle to it through handle. Returns NULL if the Arena is full
+void* ArenaPushHandle(Arena* arena, ArenaHandle* handle) {
+	assert(arena->handles != NULL);
+	void* elem = ArenaPush(arena, arena->elem_size);
+	if (!elem) {
+		return NULL;
+	}
+	ArenaHandleTable* table = ArenaHandleTableOf(arena);
+	ArenaHandleEntry* entries = ArenaHandleEntries(table);
+	uint32_t index = table->free_head;
+	if (index != ARENA_NO_HANDLE) {
+		table->free_head = entries[index].slot;
+	} else {
+		index = table->top++;
+		//generations start at 1 so a zeroed handle never resolves
+		entries[index].generation = 1;
+	}
+	uint32_t slot = ((uintptr_t)elem - arena->first_ptr) / ArenaSlotSize(arena);
+	entries[index].slot = slot;
+	ArenaHandleOwners(table)[slot] = index;
+	handle->index = index;
+	handle->generation = entries[index].generation;
+	return elem;
+}
+
+//returns the element a handle refers to wherever it has been moved, or NULL if it has been dropped since the handle was made
+void* ArenaHandlePtr(Arena* arena, ArenaHandle handle) {
+	assert(arena->handles != NULL);
+	ArenaHandleTable* table = ArenaHandleTableOf(arena);
+	if (handle.index >= table->top) {
+		return NULL;
+	}
+	ArenaHandleEntry entry = ArenaHandleEntries(table)[handle.index];
+	if (entry.generation != handle.generation || entry.slot >= table->capacity || ArenaHandleOwners(table)[entry.slot] != handle.index) {
+		return NULL;
+	}
+	return (void*)(arena->first_ptr + (size_t)entry.slot * ArenaSlotSize(arena));
+}
+
+//drops the element a handle refers to. Returns -1 if the handle is already stale
+int ArenaDropHandle(Arena* arena, ArenaHandle handle) {
+	void* elem = ArenaHandlePtr(arena, handle);
+	if (!elem) {
+		return -1;
+	}
+	ArenaDrop(arena, elem);
+	return 0;
+}
+
+//moves the live elements of a single type Arena into the order given by order, so that slot i ends up holding the element that was in slot order[i]. order must name every live slot exactly once, and there are no holes afterwards. Elements are moved in place by following the cycles of the permutation with one element of scratch, copying elem_size bytes like ArenaSwap. moved, if not NULL, is told about every element that changes address, and handles follow their elements. Returns -1 without moving anything if order isn't a permutation of the live slots
+int ArenaReorder(Arena* arena, const size_t* order, ArenaMovedFn moved, void* ctx) {
+	assert(arena->one_type == true);
+	assert(arena->elem_size >= arena->alignment);
+	if (__atomic_load_n(&arena->remote_free, __ATOMIC_RELAXED)) {
+		ArenaDrainRemote(arena);
+	}
+	size_t slot = ArenaSlotSize(arena);
+	size_t top = (arena->ptr - arena->first_ptr) / slot;
+	size_t count = ArenaLiveCount(arena);
+	Arena* live_scratch;
+	uint64_t* live = ArenaLiveBits(arena, &live_scratch);
+	size_t words = (top + 63) / 64 + 1;
+	size_t bytes = 2 * words * sizeof(uint64_t) + top * sizeof(size_t) + 2 * slot;
+	Arena* scratch = ArenaScratch(bytes);
+	//pending marks slots still holding an element that has to move, done marks slots that hold their final element
+	uint64_t* pending = (uint64_t*)ArenaPush(scratch, words * sizeof(uint64_t));
+	uint64_t* done = (uint64_t*)ArenaPush(scratch, words * sizeof(uint64_t));
+	//destination of the element in every slot
+	size_t* dest = (size_t*)ArenaPush(scratch, top * sizeof(size_t) + 1);
+	char* carried = (char*)ArenaPush(scratch, slot);
+	char* swap = (char*)ArenaPush(scratch, slot);
+	memcpy(pending, live, words * sizeof(uint64_t));
+	if (live_scratch) {
+		ArenaRelease(live_scratch);
+	}
+	//done doubles as the set of slots already seen in order while it is checked
+	for (size_t i = 0; i < count; i++) {
+		size_t from = order[i];
+		if (from >= top || !(pending[from / 64] & (1ULL << (from % 64))) || (done[from / 64] & (1ULL << (from % 64)))) {
+			fprintf(stderr, "ArenaReorder() order is not a permutation of the live elements\n");
+			ArenaRelease(scratch);
+			return -1;
+		}
+		done[from / 64] |= 1ULL << (from % 64);
+		dest[from] = i;
+	}
+	memset(done, 0, words * sizeof(uint64_t));
+	uint32_t* owners = arena->handles ? ArenaHandleOwners(ArenaHandleTableOf(arena)) : NULL;
+	ArenaHandleEntry* entries = arena->handles ? ArenaHandleEntries(ArenaHandleTableOf(arena)) : NULL;
+	for (size_t start = 0; start < top; start++) {
+		if (!(pending[start / 64] & (1ULL << (start % 64)))) {
+			continue;
+		}
+		pending[start / 64] &= ~(1ULL << (start % 64));
+		if (dest[start] == start) {
+			done[start / 64] |= 1ULL << (start % 64);
+			continue;
+		}
+		//take the element out of start and keep placing it, picking up whatever was in its destination, until an empty slot is reached
+		memcpy(carried, (void*)(arena->first_ptr + start * slot), arena->elem_size);
+		uint32_t carried_owner = owners ? owners[start] : ARENA_NO_HANDLE;
+		if (owners) {
+			owners[start] = ARENA_NO_HANDLE;
+		}
+		size_t from = start;
+		for (;;) {
+			size_t to = dest[from];
+			void* target = (void*)(arena->first_ptr + to * slot);
+			bool occupied = pending[to / 64] & (1ULL << (to % 64));
+			if (occupied) {
+				memcpy(swap, target, arena->elem_size);
+			}
+			memcpy(target, carried, arena->elem_size);
+			done[to / 64] |= 1ULL << (to % 64);
+			uint32_t next_owner = ARENA_NO_HANDLE;
+			if (owners) {
+				next_owner = occupied ? owners[to] : ARENA_NO_HANDLE;
+				owners[to] = carried_owner;
+				if (carried_owner != ARENA_NO_HANDLE) {
+					entries[carried_owner].slot = to;
+				}
+			}
+			if (moved) {
+				moved((void*)(arena->first_ptr + from * slot), target, ctx);
+			}
+			if (!occupied) {
+				break;
+			}
+			pending[to / 64] &= ~(1ULL << (to % 64));
+			memcpy(carried, swap, arena->elem_size);
+			carried_owner = next_owner;
+			from = to;
+		}
+	}
+	//every live element now sits in [0, count)
+	if (owners) {
+		for (size_t index = count; index < top; index++) {
+			owners[index] = ARENA_NO_HANDLE;
+		}
+	}
+	if (arena->occupancy) {
+		uint64_t* bits = (uint64_t*)arena->occupancy->first_ptr;
+		memset(bits, 0, ((top + 63) / 64) * sizeof(uint64_t));
+		for (size_t index = 0; index < count; index++) {
+			bits[index / 64] |= 1ULL << (index % 64);
+		}
+		arena->holes = 0;
+		arena->hole_hint = 0;
+	} else if (arena->free_list) {
+		ArenaReleaseSide(&arena->free_list);
+		arena->to_free = NULL;
+	}
+	arena->ptr = arena->first_ptr + count * slot;
+	if (arena->stats) {
+		ArenaStatsUpdate(arena, 0);
+	}
+	ArenaRelease(scratch);
+	return 0;
+}
+
+typedef struct ArenaKeyed {
+	uint64_t key;
+	size_t slot;
+} ArenaKeyed;
+
+static int ArenaCompareKeyed(const void* a, const void* b) {
+	const ArenaKeyed* x = (const ArenaKeyed*)a;
+	const ArenaKeyed* y = (const ArenaKeyed*)b;
+	if (x->key != y->key) {
+		return x->key < y->key ? -1 : 1;
+	}
+	return x->slot < y->slot ? -1 : x->slot > y->slot;
+}
+
+typedef struct ArenaKeyCollect {
+	Arena* arena;
+	ArenaKeyFn key;
+	void* ctx;
+	ArenaKeyed* keyed;
+	size_t count;
+} ArenaKeyCollect;
+
+static void ArenaCollectKey(void* elem, void* ctx) {
+	ArenaKeyCollect* collect = (ArenaKeyCollect*)ctx;
+	ArenaKeyed* keyed = &collect->keyed[collect->count++];
+	keyed->key = collect->key(elem, collect->ctx);
+	keyed->slot = ((uintptr_t)elem - collect->arena->first_ptr) / ArenaSlotSize(collect->arena);
+}
+
+//like ArenaReorder, but sorts the live elements by the key returned by key. Elements with equal keys keep their current order. ctx is passed to both key and moved
+int ArenaReorderBy(Arena* arena, ArenaKeyFn key, ArenaMovedFn moved, void* ctx) {
+	assert(arena->one_type == true);
+	size_t count = ArenaLiveCount(arena);
+	size_t bytes = count * (sizeof(ArenaKeyed) + sizeof(size_t)) + 1;
+	Arena* scratch = ArenaScratch(bytes);
+	ArenaKeyCollect collect = {arena, key, ctx, (ArenaKeyed*)ArenaPush(scratch, count * sizeof(ArenaKeyed) + 1), 0};
+	ArenaForEach(arena, ArenaCollectKey, &collect);
+	qsort(collect.keyed, count, sizeof(ArenaKeyed), ArenaCompareKeyed);
+	size_t* order = (size_t*)ArenaPush(scratch, count * sizeof(size_t) + 1);
+	for (size_t i = 0; i < count; i++) {
+		order[i] = collect.keyed[i].slot;
+	}
+	int res = ArenaReorder(arena, order, moved, ctx);
+	ArenaRelease(scratch);
+	return res;
+}
+
+//number of set bits in the slots [from, to) of a bitmap
+static size_t ArenaCountBits(const uint64_t* bits, size_t from, size_t to) {
+	size_t count = 0;
+	while (from < to && from % 64 != 0) {
+		count += (bits[from / 64] >> (from % 64)) & 1;
+		from++;
+	}
+	for (; from + 64 <= to; from += 64) {
+		count += __builtin_popcountll(bits[from / 64]);
+	}
+	for (; from < to; from++) {
+		count += (bits[from / 64] >> (from % 64)) & 1;
+	}
+	return count;
+}
+
+//highest set slot in [low, below) of a bitmap, or below if there is none
+static size_t ArenaPrevBit(const uint64_t* bits, size_t below, size_t low) {
+	size_t at = below;
+	while (at > low) {
+		size_t index = at - 1;
+		uint64_t word = bits[index / 64] & (UINT64_MAX >> (63 - index % 64));
+		if (word) {
+			size_t found = (index / 64) * 64 + 63 - __builtin_clzll(word);
+			return found >= low ? found : below;
+		}
+		at = (index / 64) * 64;
+	}
+	return below;
+}
+
+//one partition of the slots of an Arena being compacted by ArenaDefragParallel
+typedef struct ArenaDefragJob {
+	Arena* arena;
+	const uint64_t* bits;
+	//slots of this partition, on word boundaries
+	size_t from;
+	size_t to;
+	//number of live elements, which is where the compacted Arena will end
+	size_t live;
+	//holes below live and elements at or above it in this partition
+	size_t holes;
+	size_t movers;
+	//holes below live in earlier partitions, and elements at or above it in later ones
+	size_t holes_before;
+	size_t movers_after;
+	struct ArenaDefragJob* jobs;
+	unsigned count;
+	bool fill;
+} ArenaDefragJob;
+
+//first pass counts the holes and the elements that have to move in a partition. Second pass fills the holes of the partition, the k-th hole from the bottom of the Arena taking the k-th element from the top just like the sequential ArenaDefrag
+static void* ArenaDefragThread(void* arg) {
+	ArenaDefragJob* job = (ArenaDefragJob*)arg;
+	size_t live = job->live;
+	if (!job->fill) {
+		size_t below = job->to < live ? job->to : live;
+		job->holes = job->from < below ? (below - job->from) - ArenaCountBits(job->bits, job->from, below) : 0;
+		size_t above = job->from > live ? job->from : live;
+		job->movers = above < job->to ? ArenaCountBits(job->bits, above, job->to) : 0;
+		return NULL;
+	}
+	if (!job->holes) {
+		return NULL;
+	}
+	Arena* arena = job->arena;
+	size_t slot = ArenaSlotSize(arena);
+	//find the partition holding the element of rank holes_before counted from the top, then the element itself
+	size_t rank = job->holes_before;
+	unsigned part = job->count - 1;
+	while (job->jobs[part].movers_after + job->jobs[part].movers <= rank) {
+		part--;
+	}
+	ArenaDefragJob* source = &job->jobs[part];
+	size_t skip = rank - source->movers_after;
+	size_t low = source->from > live ? source->from : live;
+	size_t mover = ArenaPrevBit(job->bits, source->to, low);
+	while (skip--) {
+		mover = ArenaPrevBit(job->bits, mover, live);
+	}
+	size_t below = job->to < live ? job->to : live;
+	size_t filled = 0;
+	for (size_t hole = job->from; hole < below && filled < job->holes; hole++) {
+		if (job->bits[hole / 64] & (1ULL << (hole % 64))) {
+			continue;
+		}
+		if (filled) {
+			mover = ArenaPrevBit(job->bits, mover, live);
+		}
+		memcpy((void*)(arena->first_ptr + hole * slot), (void*)(arena->first_ptr + mover * slot), arena->elem_size);
+		ArenaMoveHandle(arena, mover, hole);
+		filled++;
+	}
+	return NULL;
+}
+
+static void ArenaRunDefragJobs(ArenaDefragJob* jobs, pthread_t* ids, unsigned count) {
+	for (unsigned i = 1; i < count; i++) {
+		if (pthread_create(&ids[i], NULL, ArenaDefragThread, &jobs[i]) != 0) {
+			ArenaDefragThread(&jobs[i]);
+			ids[i] = 0;
+		}
+	}
+	ArenaDefragThread(&jobs[0]);
+	for (unsigned i = 1; i < count; i++) {
+		if (ids[i]) {
+			pthread_join(ids[i], NULL);
+		}
+	}
+}
+
+//compacts a single type Arena like ArenaDefrag with an occupancy bitmap, but splits the slots into partitions handled by separate threads. Each partition counts its holes and the elements that have to move, a prefix sum over the partitions tells each one which elements fill its holes, and then all partitions move their elements at once. Elements end up exactly where the sequential ArenaDefrag puts them when occupancy is tracked. threads = 0 uses one thread per online CPU
+void ArenaDefragParallel(Arena* arena, unsigned threads) {
+	assert(arena->elem_size >= arena->alignment);
+	assert(arena->one_type == true);
+	if (__atomic_load_n(&arena->remote_free, __ATOMIC_RELAXED)) {
+		ArenaDrainRemote(arena);
+	}
+	if (threads == 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cpus > 0 ? cpus : 1;
+	}
+	size_t slot = ArenaSlotSize(arena);
+	size_t top = (arena->ptr - arena->first_ptr) / slot;
+	Arena* scratch;
+	uint64_t* bits = ArenaLiveBits(arena, &scratch);
+	size_t live = ArenaCountBits(bits, 0, top);
+	if (live < top) {
+		size_t words = (top + 63) / 64;
+		if (threads > words) {
+			threads = words;
+		}
+		size_t bytes = threads * (sizeof(ArenaDefragJob) + sizeof(pthread_t));
+		Arena* jobs_arena = ArenaScratch(bytes);
+		ArenaDefragJob* jobs = (ArenaDefragJob*)ArenaPush(jobs_arena, threads * sizeof(ArenaDefragJob));
+		pthread_t* ids = (pthread_t*)ArenaPush(jobs_arena, threads * sizeof(pthread_t));
+		size_t per_thread = (words + threads - 1) / threads;
+		for (unsigned i = 0; i < threads; i++) {
+			size_t from = i * per_thread * 64;
+			size_t to = (i + 1) * per_thread * 64;
+			jobs[i].arena = arena;
+			jobs[i].bits = bits;
+			jobs[i].from = from < top ? from : top;
+			jobs[i].to = to < top ? to : top;
+			jobs[i].live = live;
+			jobs[i].jobs = jobs;
+			jobs[i].count = threads;
+			jobs[i].fill = false;
+		}
+		ArenaRunDefragJobs(jobs, ids, threads);
+		size_t holes = 0;
+		for (unsigned i = 0; i < threads; i++) {
+			jobs[i].holes_before = holes;
+			holes += jobs[i].holes;
+			jobs[i].fill = true;
+		}
+		size_t movers = 0;
+		for (unsigned i = threads; i-- > 0;) {
+			jobs[i].movers_after = movers;
+			movers += jobs[i].movers;
+		}
+		assert(holes == movers);
+		ArenaRunDefragJobs(jobs, ids, threads);
+		ArenaRelease(jobs_arena);
+	}
+	if (scratch) {
+		ArenaRelease(scratch);
+	}
+	if (arena->occupancy) {
+		memset(bits, 0, ((top + 63) / 64) * sizeof(uint64_t));
+		for (size_t index = 0; index < live / 64; index++) {
+			bits[index] = UINT64_MAX;
+		}
+		if (live % 64) {
+			bits[live / 64] = (1ULL << (live % 64)) - 1;
+		}
+		arena->holes = 0;
+		arena->hole_hint = 0;
+	} else if (arena->free_list) {
+		ArenaReleaseSide(&arena->free_list);
+		arena->to_free = NULL;
+	}
+	arena->ptr = arena->first_ptr + live * slot;
+	if (arena->stats) {
+		ArenaStatsUpdate(arena, 0);
+	}
+}
+
+//faults in the pages of [from, to) for writing. Uses MADV_POPULATE_WRITE and falls back to touching every page on kernels older than 5.14
+static int ArenaPopulate(uintptr_t from, uintptr_t to) {
+	long page_size = getpagesize();
+	from &= ~(uintptr_t)(page_size - 1);
+	if (from >= to) {
+		return 0;
+	}
+	if (madvise((void*)from, to - from, MADV_POPULATE_WRITE) == 0) {
+		return 0;
+	}
+	for (uintptr_t page = from; page < to; page += page_size) {
+		//an atomic or of 0 write faults the page without changing it, even if the owner of the arena writes to it at the same time
+		__atomic_fetch_or((char*)page, 0, __ATOMIC_RELAXED);
+	}
+	return 0;
+}
+
+//number of ranges that can wait for the touch-ahead thread at once. Pushes that find the queue full just take their faults themselves
+#define ARENA_TOUCH_QUEUE 64
+
+//range of an arena for the touch-ahead thread to fault in
+typedef struct ArenaTouchJob {
+	Arena* arena;
+	uintptr_t from;
+	uintptr_t to;
+} ArenaTouchJob;
+
+//queue of the touch-ahead thread, shared by every arena that uses ArenaSetTouchAhead
+typedef struct ArenaToucher {
+	ArenaTouchJob jobs[ARENA_TOUCH_QUEUE];
+	unsigned head;
+	unsigned count;
+	//arena the thread is faulting in right now, outside the lock
+	Arena* busy;
+	//process the thread runs in. A forked child has the queue but not the thread
+	pid_t pid;
+} ArenaToucher;
+
+static ArenaToucher arena_toucher;
+static pthread_mutex_t arena_toucher_lock = PTHREAD_MUTEX_INITIALIZER;
+//signalled when a job is queued
+static pthread_cond_t arena_toucher_wake = PTHREAD_COND_INITIALIZER;
+//broadcast when a job is done
+static pthread_cond_t arena_toucher_done = PTHREAD_COND_INITIALIZER;
+static pthread_once_t arena_toucher_once = PTHREAD_ONCE_INIT;
+
+static void* ArenaToucherRun(void* arg) {
+	(void)arg;
+	pthread_mutex_lock(&arena_toucher_lock);
+	for (;;) {
+		while (!arena_toucher.count) {
+			pthread_cond_wait(&arena_toucher_wake, &arena_toucher_lock);
+		}
+		ArenaTouchJob job = arena_toucher.jobs[arena_toucher.head];
+		arena_toucher.head = (arena_toucher.head + 1) % ARENA_TOUCH_QUEUE;
+		arena_toucher.count--;
+		arena_toucher.busy = job.arena;
+		pthread_mutex_unlock(&arena_toucher_lock);
+		ArenaPopulate(job.from, job.to);
+		pthread_mutex_lock(&arena_toucher_lock);
+		arena_toucher.busy = NULL;
+		pthread_cond_broadcast(&arena_toucher_done);
+	}
+	return NULL;
+}
+
+static void ArenaToucherLock(void) {
+	pthread_mutex_lock(&arena_toucher_lock);
+}
+
+static void ArenaToucherUnlock(void) {
+	pthread_mutex_unlock(&arena_toucher_lock);
+}
+
+static void ArenaToucherStart(void) {
+	pthread_t thread;
+	//a fork while the thread holds the lock would leave it locked in the child for good
+	pthread_atfork(ArenaToucherLock, ArenaToucherUnlock, ArenaToucherUnlock);
+	arena_toucher.pid = getpid();
+	if (pthread_create(&thread, NULL, ArenaToucherRun, NULL) != 0) {
+		perror("couldn't start the touch-ahead thread");
+		arena_toucher.pid = 0;
+		return;
+	}
+	pthread_detach(thread);
+}
+
+//true if a job for arena is queued
+static bool ArenaTouchQueued(Arena* arena) {
+	for (unsigned i = 0; i < arena_toucher.count; i++) {
+		if (arena_toucher.jobs[(arena_toucher.head + i) % ARENA_TOUCH_QUEUE].arena == arena) {
+			return true;
+		}
+	}
+	return false;
+}
+
+//waits until the touch-ahead thread has faulted in every range queued for arena, for callers that need the pages resident right now
+void ArenaTouchWait(Arena* arena) {
+	pthread_mutex_lock(&arena_toucher_lock);
+	while (arena_toucher.pid == getpid() && (arena_toucher.busy == arena || ArenaTouchQueued(arena))) {
+		pthread_cond_wait(&arena_toucher_done, &arena_toucher_lock);
+	}
+	pthread_mutex_unlock(&arena_toucher_lock);
+}
+
+//takes the ranges of arena off the queue and waits for the one being faulted in, so none of them is touched once the arena is unmapped
+static void ArenaTouchForget(Arena* arena) {
+	pthread_mutex_lock(&arena_toucher_lock);
+	unsigned kept = 0;
+	for (unsigned i = 0; i < arena_toucher.count; i++) {
+		ArenaTouchJob job = arena_toucher.jobs[(arena_toucher.head + i) % ARENA_TOUCH_QUEUE];
+		if (job.arena != arena) {
+			arena_toucher.jobs[(arena_toucher.head + kept++) % ARENA_TOUCH_QUEUE] = job;
+		}
+	}
+	arena_toucher.count = kept;
+	while (arena_toucher.pid == getpid() && arena_toucher.busy == arena) {
+		pthread_cond_wait(&arena_toucher_done, &arena_toucher_lock);
+	}
+	pthread_mutex_unlock(&arena_toucher_lock);
+}
+
+//allocates an arena like ArenaAlloc. ARENA_POPULATE faults in every page up front, ARENA_LOCK also locks them in RAM. Returns NULL if the arena can't be locked, which usually means RLIMIT_MEMLOCK is too low
+Arena* ArenaAllocEx(unsigned pages, unsigned flags) {
+	Arena* arena = ArenaAlloc(pages);
+	if (!arena) {
+		return NULL;
+	}
+	if (flags & (ARENA_POPULATE | ARENA_LOCK)) {
+		ArenaPopulate((uintptr_t)arena, arena->end_ptr);
+		arena->touched_ptr = arena->end_ptr;
+	}
+	if ((flags & ARENA_LOCK) && mlock(arena, arena->size) != 0) {
+		perror("couldn't lock arena");
+		ArenaRelease(arena);
+		return NULL;
+	}
+	return arena;
+}
+
+//queues the next touch_ahead bytes past ptr for the touch-ahead thread to fault in and moves the mark at which ArenaPush calls this again to halfway through them. The push that crosses the mark only takes a lock and signals the thread, the faults are taken off the push path ahead of the pushes that would have hit them
+void ArenaTouchAhead(Arena* arena) {
+	uintptr_t want = arena->ptr + arena->touch_ahead;
+	if (want > arena->end_ptr) {
+		want = arena->end_ptr;
+	}
+	if (want > arena->touched_ptr) {
+		pthread_once(&arena_toucher_once, ArenaToucherStart);
+		pthread_mutex_lock(&arena_toucher_lock);
+		if (arena_toucher.pid == getpid() && arena_toucher.count < ARENA_TOUCH_QUEUE) {
+			ArenaTouchJob job = {arena, arena->touched_ptr > arena->ptr ? arena->touched_ptr : arena->ptr, want};
+			arena_toucher.jobs[(arena_toucher.head + arena_toucher.count) % ARENA_TOUCH_QUEUE] = job;
+			arena_toucher.count++;
+			arena->touched_ptr = want;
+			pthread_cond_signal(&arena_toucher_wake);
+		}
+		pthread_mutex_unlock(&arena_toucher_lock);
+	}
+	arena->touch_at = want >= arena->end_ptr ? arena->end_ptr : want - arena->touch_ahead / 2;
+}
+
+//keeps the next pages pages past ptr faulted in by a helper thread as the arena grows, so pushes don't take the first-touch page fault themselves. 0 turns it off. The thread is started on first use and shared by every arena
+void ArenaSetTouchAhead(Arena* arena, unsigned pages) {
+	arena->touch_ahead = (size_t)pages * getpagesize();
+	if (pages == 0) {
+		arena->touch_at = arena->end_ptr;
+		ArenaTouchForget(arena);
+		return;
+	}
+	ArenaTouchAhead(arena);
+}
+
+//creates a ring arena of pages pages. The memory is reserved as one block first so the two mappings of the memfd can be placed back to back over it
+ArenaRing* ArenaRingAlloc(unsigned pages) {
+	long page_size = getpagesize();
+	size_t size = (size_t)(pages ? pages : 1) * page_size;
+	size_t header = (sizeof(ArenaRing) + page_size - 1) & ~(page_size - 1);
+	char* block = (char*) mmap(NULL, header + 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (block == (char*)MAP_FAILED) {
+		perror("couldn't reserve ring arena");
+		return NULL;
+	}
+	int fd = memfd_create("arena-ring", MFD_CLOEXEC);
+	if (fd == -1 || ftruncate(fd, size) != 0 ||
+		mmap(block, header, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED ||
+		mmap(block + header, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+		mmap(block + header + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+		perror("couldn't map ring arena");
+		if (fd != -1) {
+			close(fd);
+		}
+		munmap(block, header + 2 * size);
+		return NULL;
+	}
+	ArenaRing* ring = (ArenaRing*)block;
+	ring->size = size;
+	ring->fd = fd;
+	ring->data = block + header;
+	ring->head = 0;
+	ring->tail = 0;
+	return ring;
+}
+
+int ArenaRingRelease(ArenaRing* ring) {
+	if (!ring) {
+		return -1;
+	}
+	size_t header = (uintptr_t)ring->data - (uintptr_t)ring;
+	int fd = ring->fd;
+	int res = munmap(ring, header + 2 * ring->size);
+	close(fd);
+	return res;
+}
+
+//returns size contiguous bytes at the head of the ring for the producer to fill, or NULL if there isn't that much free space. The bytes are only handed to the consumer by ArenaRingCommit
+void* ArenaRingPush(ArenaRing* ring, size_t size) {
+	uint64_t head = ring->head;
+	uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	if (size == 0 || size > ring->size - (head - tail)) {
+		return NULL;
+	}
+	return ring->data + head % ring->size;
+}
+
+//publishes the next size bytes filled in after ArenaRingPush to the consumer
+void ArenaRingCommit(ArenaRing* ring, size_t size) {
+	assert(size <= ring->size - (ring->head - __atomic_load_n(&ring->tail, __ATOMIC_RELAXED)));
+	__atomic_store_n(&ring->head, ring->head + size, __ATOMIC_RELEASE);
+}
+
+//returns the oldest committed bytes for the consumer and stores how many there are in available. They are contiguous even when they wrap past the end of the ring. Returns NULL if the ring is empty
+void* ArenaRingPeek(ArenaRing* ring, size_t* available) {
+	uint64_t tail = ring->tail;
+	uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	*available = head - tail;
+	if (head == tail) {
+		return NULL;
+	}
+	return ring->data + tail % ring->size;
+}
+
+//hands the oldest size bytes back to the producer once the consumer is done with them
+void ArenaRingDrop(ArenaRing* ring, size_t size) {
+	assert(size <= __atomic_load_n(&ring->head, __ATOMIC_RELAXED) - ring->tail);
+	__atomic_store_n(&ring->tail, ring->tail + size, __ATOMIC_RELEASE);
+}
+
+//reads up to max bytes from fd straight into the free space of the ring and commits them, with a single read even when the space wraps. Returns what read returned, or 0 without reading if the ring is full
+ssize_t ArenaRingReadFrom(ArenaRing* ring, int fd, size_t max) {
+	uint64_t head = ring->head;
+	size_t space = ring->size - (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE));
+	if (max > space) {
+		max = space;
+	}
+	if (max == 0) {
+		return 0;
+	}
+	ssize_t n = read(fd, ring->data + head % ring->size, max);
+	if (n > 0) {
+		ArenaRingCommit(ring, n);
+	}
+	return n;
+}
+
+//writes up to max of the oldest bytes in the ring straight to fd and drops whatever was written. Returns what write returned, or 0 without writing if the ring is empty
+ssize_t ArenaRingWriteTo(ArenaRing* ring, int fd, size_t max) {
+	size_t available;
+	void* data = ArenaRingPeek(ring, &available);
+	if (max > available) {
+		max = available;
+	}
+	if (!data || max == 0) {
+		return 0;
+	}
+	ssize_t n = write(fd, data, max);
+	if (n > 0) {
+		ArenaRingDrop(ring, n);
+	}
+	return n;
+}
+
+//creates count arenas of pages pages each for ArenaFrameBegin to rotate through. With decommit set, resetting an arena also drops the pages it used past what recent frames have needed, so one big frame doesn't stay resident
+ArenaFrames* ArenaFramesAlloc(unsigned count, unsigned pages, bool decommit) {
+	if (count == 0) {
+		return NULL;
+	}
+	long page_size = getpagesize();
+	size_t bytes = sizeof(ArenaFrames) + count * (sizeof(Arena*) + sizeof(uintptr_t)) + 3 * sizeof(void*);
+	Arena* holder = ArenaAllocSide((bytes + sizeof(Arena) + page_size - 1) / page_size);
+	ArenaFrames* frames = (ArenaFrames*)ArenaPush(holder, sizeof(ArenaFrames));
+	frames->holder = holder;
+	frames->count = count;
+	frames->current = count - 1;
+	frames->decommit = decommit;
+	frames->learned = 0;
+	frames->arenas = (Arena**)ArenaPush(holder, count * sizeof(Arena*));
+	frames->peaks = (uintptr_t*)ArenaPush(holder, count * sizeof(uintptr_t));
+	for (unsigned i = 0; i < count; i++) {
+		frames->arenas[i] = ArenaAlloc(pages);
+		frames->peaks[i] = frames->arenas[i]->first_ptr;
+	}
+	return frames;
+}
+
+int ArenaFramesRelease(ArenaFrames* frames) {
+	if (!frames) {
+		return -1;
+	}
+	int res = 0;
+	for (unsigned i = 0; i < frames->count; i++) {
+		if (ArenaRelease(frames->arenas[i]) != 0) {
+			res = -1;
+		}
+	}
+	if (ArenaRelease(frames->holder) != 0) {
+		res = -1;
+	}
+	return res;
+}
+
+//starts a new frame. The oldest arena is emptied at both ends and handed out, the others keep the data of the frames before it. Only the bottom end counts towards the learned frame size and is decommitted
+Arena* ArenaFrameBegin(ArenaFrames* frames) {
+	frames->current = (frames->current + 1) % frames->count;
+	unsigned index = frames->current;
+	Arena* arena = frames->arenas[index];
+	size_t used = arena->ptr - arena->first_ptr;
+	if (arena->ptr > frames->peaks[index]) {
+		frames->peaks[index] = arena->ptr;
+	}
+	ArenaDropTo(arena, (void*)arena->first_ptr);
+	ArenaDropToHigh(arena, (void*)arena->end_ptr);
+	if (!frames->decommit) {
+		return arena;
+	}
+	frames->learned = used > frames->learned ? used : frames->learned - (frames->learned - used) / 8;
+	long page_size = getpagesize();
+	uintptr_t keep = (arena->first_ptr + frames->learned + page_size - 1) & ~(uintptr_t)(page_size - 1);
+	if (frames->peaks[index] > keep) {
+		madvise((void*)keep, frames->peaks[index] - keep, MADV_DONTNEED);
+		frames->peaks[index] = keep;
+		if (arena->touched_ptr > keep) {
+			arena->touched_ptr = keep;
+		}
+		if (arena->touch_ahead) {
+			ArenaTouchAhead(arena);
+		}
+	}
+	return arena;
+}
+
+//returns the arena of the frame ago frames before the current one, 0 being the current frame. Its data stays valid until count - ago more frames have begun
+Arena* ArenaFrameAgo(ArenaFrames* frames, unsigned ago) {
+	assert(ago < frames->count);
+	return frames->arenas[(frames->current + frames->count - ago) % frames->count];
+}
+
+//creates an epoch domain whose retired drops are kept in an arena of pages pages
+ArenaEpoch* ArenaEpochAlloc(unsigned pages) {
+	long page_size = getpagesize();
+	Arena* holder = ArenaAllocSide((sizeof(Arena) + sizeof(ArenaEpoch) + 64 + page_size) / page_size);
+	ArenaSetAlignment(holder, 64);
+	ArenaEpoch* domain = (ArenaEpoch*)ArenaPush(holder, sizeof(ArenaEpoch));
+	memset(domain, 0, sizeof(ArenaEpoch));
+	domain->global = 1;
+	domain->holder = holder;
+	domain->retired = ArenaAllocSide(pages ? pages : 1);
+	for (unsigned i = 0; i < ARENA_MAX_READERS; i++) {
+		domain->readers[i].domain = domain;
+	}
+	return domain;
+}
+
+static void ArenaRunRetired(ArenaRetired* record) {
+	Arena* arena = record->arena;
+	if (record->top) {
+		//anything pushed since the roll back was retired would be thrown away with it
+		if (arena->ptr == record->top) {
+			ArenaDropTo(arena, record->ptr);
+		}
+	} else if ((uintptr_t)record->ptr < arena->ptr) {
+		ArenaDrop(arena, record->ptr);
+	}
+}
+
+//runs the retired drops that every reader has moved past and returns how many ran. Only the writer calls this, it is also called by ArenaRetireDrop and ArenaRetireDropTo when the retired list fills up
+size_t ArenaEpochReclaim(ArenaEpoch* domain) {
+	//readers that enter from here on see the epoch after every drop retired so far
+	uint64_t oldest = __atomic_add_fetch(&domain->global, 1, __ATOMIC_SEQ_CST);
+	for (unsigned i = 0; i < ARENA_MAX_READERS; i++) {
+		uint64_t epoch = __atomic_load_n(&domain->readers[i].epoch, __ATOMIC_SEQ_CST);
+		if (epoch && epoch < oldest) {
+			oldest = epoch;
+		}
+	}
+	ArenaRetired* records = (ArenaRetired*)domain->retired->first_ptr;
+	size_t count = (domain->retired->ptr - domain->retired->first_ptr) / sizeof(ArenaRetired);
+	size_t ready = 0;
+	while (ready < count && records[ready].epoch < oldest) {
+		ready++;
+	}
+	//newest first, so roll backs retired one after the other still line up with ptr
+	for (size_t i = ready; i > 0; i--) {
+		ArenaRunRetired(&records[i - 1]);
+	}
+	if (ready) {
+		memmove(records, records + ready, (count - ready) * sizeof(ArenaRetired));
+		ArenaDropTo(domain->retired, records + (count - ready));
+	}
+	return ready;
+}
+
+static int ArenaRetire(ArenaEpoch* domain, Arena* arena, void* ptr, uintptr_t top) {
+	Arena* retired = domain->retired;
+	if (retired->ptr + 2 * sizeof(ArenaRetired) + retired->alignment >= retired->high_ptr) {
+		ArenaEpochReclaim(domain);
+	}
+	ArenaRetired* record = (ArenaRetired*)ArenaPush(retired, sizeof(ArenaRetired));
+	if (!record) {
+		fprintf(stderr, "ArenaEpoch retired list is full, a reader has stayed in an old epoch\n");
+		return -1;
+	}
+	record->arena = arena;
+	record->ptr = ptr;
+	record->top = top;
+	record->epoch = __atomic_load_n(&domain->global, __ATOMIC_SEQ_CST);
+	return 0;
+}
+
+//ArenaDrop of a single type Arena element that readers may still be looking at. The slot is only handed out again once every reader that could have seen it has left its epoch
+int ArenaRetireDrop(ArenaEpoch* domain, Arena* arena, void* ptr) {
+	return ArenaRetire(domain, arena, ptr, 0);
+}
+
+//ArenaDropTo that waits for readers like ArenaRetireDrop. If the arena has been pushed to or rolled back by the time it runs it is skipped, since dropping to pos would take the newer data with it
+int ArenaRetireDropTo(ArenaEpoch* domain, Arena* arena, void* pos) {
+	return ArenaRetire(domain, arena, pos, arena->ptr);
+}
+
+//claims a reader slot for the calling thread. Returns NULL if all ARENA_MAX_READERS slots are taken
+ArenaEpochReader* ArenaEpochJoin(ArenaEpoch* domain) {
+	for (unsigned i = 0; i < ARENA_MAX_READERS; i++) {
+		uint32_t unused = 0;
+		if (__atomic_compare_exchange_n(&domain->readers[i].joined, &unused, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			return &domain->readers[i];
+		}
+	}
+	fprintf(stderr, "ArenaEpochJoin() no free reader slots\n");
+	return NULL;
+}
+
+//gives the slot back. The reader must be outside any epoch
+void ArenaEpochQuit(ArenaEpochReader* reader) {
+	assert(reader->epoch == 0);
+	__atomic_store_n(&reader->joined, 0, __ATOMIC_RELEASE);
+}
+
+//starts a read side section. Nothing retired from here on is reclaimed until the matching ArenaEpochLeave
+void ArenaEpochEnter(ArenaEpochReader* reader) {
+	__atomic_store_n(&reader->epoch, __atomic_load_n(&reader->domain->global, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+	//the epoch has to be visible before anything in the arenas is read
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void ArenaEpochLeave(ArenaEpochReader* reader) {
+	__atomic_store_n(&reader->epoch, 0, __ATOMIC_RELEASE);
+}
+
+//runs every drop that is still retired and frees the domain. No reader may be inside an epoch
+int ArenaEpochRelease(ArenaEpoch* domain) {
+	if (!domain) {
+		return -1;
+	}
+	ArenaRetired* records = (ArenaRetired*)domain->retired->first_ptr;
+	size_t count = (domain->retired->ptr - domain->retired->first_ptr) / sizeof(ArenaRetired);
+	for (size_t i = count; i > 0; i--) {
+		ArenaRunRetired(&records[i - 1]);
+	}
+	int res = ArenaRelease(domain->retired);
+	if (ArenaRelease(domain->holder) != 0) {
+		res = -1;
+	}
+	return res;
+}
+
+//CPU the calling thread is running on. Read from the rseq area the kernel keeps up to date for every thread when glibc has registered one, which is a plain load, otherwise from sched_getcpu
+static unsigned ArenaCurrentCpu(void) {
+#ifdef ARENA_HAVE_RSEQ
+	if (__rseq_size) {
+		struct rseq* area = (struct rseq*)((char*)__builtin_thread_pointer() + __rseq_offset);
+		int32_t cpu = (int32_t)__atomic_load_n(&area->cpu_id, __ATOMIC_RELAXED);
+		if (cpu >= 0) {
+			return cpu;
+		}
+	}
+#endif
+	int cpu = sched_getcpu();
+	return cpu < 0 ? 0 : cpu;
+}
+
+//creates one arena of pages pages for every configured CPU
+ArenaShards* ArenaShardsAlloc(unsigned pages) {
+	long cpus = sysconf(_SC_NPROCESSORS_CONF);
+	unsigned count = cpus > 0 ? cpus : 1;
+	long page_size = getpagesize();
+	size_t bytes = sizeof(Arena) + sizeof(ArenaShards) + (count + 2) * sizeof(ArenaShard);
+	Arena* holder = ArenaAllocSide((bytes + page_size - 1) / page_size);
+	ArenaShards* sharded = (ArenaShards*)ArenaPush(holder, sizeof(ArenaShards));
+	ArenaSetAlignment(holder, 64);
+	sharded->holder = holder;
+	sharded->count = count;
+	sharded->shards = (ArenaShard*)ArenaPush(holder, count * sizeof(ArenaShard));
+	for (unsigned i = 0; i < count; i++) {
+		sharded->shards[i].lock = 0;
+		sharded->shards[i].arena = ArenaAlloc(pages);
+	}
+	return sharded;
+}
+
+int ArenaShardsRelease(ArenaShards* sharded) {
+	if (!sharded) {
+		return -1;
+	}
+	int res = 0;
+	for (unsigned i = 0; i < sharded->count; i++) {
+		if (ArenaRelease(sharded->shards[i].arena) != 0) {
+			res = -1;
+		}
+	}
+	if (ArenaRelease(sharded->holder) != 0) {
+		res = -1;
+	}
+	return res;
+}
+
+//pushes size bytes to the arena of the CPU the calling thread is on. Safe to call from any number of threads. Returns NULL if that CPU's arena is full. The shard is only a locality hint: the thread can migrate between reading the CPU and taking the shard's lock, so the push may land in another CPU's arena and callers must not rely on which one it is
+void* ArenaShardPush(ArenaShards* sharded, size_t size) {
+	ArenaShard* shard = &sharded->shards[ArenaCurrentCpu() % sharded->count];
+	while (__atomic_exchange_n(&shard->lock, 1, __ATOMIC_ACQUIRE)) {
+		while (__atomic_load_n(&shard->lock, __ATOMIC_RELAXED)) {
+			sched_yield();
+		}
+	}
+	void* ptr = ArenaPush(shard->arena, size);
+	__atomic_store_n(&shard->lock, 0, __ATOMIC_RELEASE);
+	return ptr;
+}
+
+//creates a pool of slots of elem_size bytes in an arena of pages pages
+ArenaPool* ArenaPoolAlloc(size_t elem_size, unsigned pages) {
+	assert(elem_size >= 2 * sizeof(uint32_t));
+	long page_size = getpagesize();
+	Arena* holder = ArenaAllocSide((sizeof(Arena) + sizeof(ArenaPool) + 64 + page_size - 1) / page_size);
+	ArenaSetAlignment(holder, 64);
+	ArenaPool* pool = (ArenaPool*)ArenaPush(holder, sizeof(ArenaPool));
+	pool->head = 0;
+	pool->top = 0;
+	pool->holder = holder;
+	pool->arena = ArenaAlloc(pages);
+	pool->arena->one_type = true;
+	pool->arena->elem_size = elem_size;
+	pool->slot = ArenaSlotSize(pool->arena);
+	pool->capacity = (pool->arena->end_ptr - pool->arena->first_ptr) / pool->slot;
+	if (pool->capacity >= UINT32_MAX) {
+		pool->capacity = UINT32_MAX - 1;
+	}
+	return pool;
+}
+
+int ArenaPoolRelease(ArenaPool* pool) {
+	if (!pool) {
+		return -1;
+	}
+	int res = ArenaRelease(pool->arena);
+	if (ArenaRelease(pool->holder) != 0) {
+		res = -1;
+	}
+	return res;
+}
+
+static uint32_t* ArenaPoolLinks(ArenaPool* pool, uint32_t index) {
+	return (uint32_t*)(pool->arena->first_ptr + (index - 1) * pool->slot);
+}
+
+//pushes the batch starting at slot first, already linked through the first words of its slots, onto the pool
+static void ArenaPoolPushBatch(ArenaPool* pool, uint32_t first) {
+	uint32_t* links = ArenaPoolLinks(pool, first);
+	uint64_t head = __atomic_load_n(&pool->head, __ATOMIC_RELAXED);
+	uint64_t next;
+	do {
+		__atomic_store_n(&links[1], (uint32_t)head, __ATOMIC_RELAXED);
+		next = ((head >> 32) + 1) << 32 | first;
+	} while (!__atomic_compare_exchange_n(&pool->head, &head, next, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+//pops the top batch and returns the index + 1 of its first slot, 0 if there are no free slots
+static uint32_t ArenaPoolPopBatch(ArenaPool* pool) {
+	uint64_t head = __atomic_load_n(&pool->head, __ATOMIC_ACQUIRE);
+	uint64_t next;
+	do {
+		if ((uint32_t)head == 0) {
+			return 0;
+		}
+		//the slot may be popped and reused by another thread while this is read, the tag makes the CAS fail if it was
+		uint32_t below = __atomic_load_n(&ArenaPoolLinks(pool, (uint32_t)head)[1], __ATOMIC_RELAXED);
+		next = ((head >> 32) + 1) << 32 | below;
+	} while (!__atomic_compare_exchange_n(&pool->head, &head, next, true, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+	return (uint32_t)head;
+}
+
+//takes up to want never used slots from the bump and returns the index + 1 of the first one, storing how many were taken in got
+static uint32_t ArenaPoolBump(ArenaPool* pool, unsigned want, unsigned* got) {
+	uint64_t top = __atomic_load_n(&pool->top, __ATOMIC_RELAXED);
+	uint64_t take;
+	do {
+		take = pool->capacity - top < want ? pool->capacity - top : want;
+		if (take == 0) {
+			*got = 0;
+			return 0;
+		}
+	} while (!__atomic_compare_exchange_n(&pool->top, &top, top + take, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	*got = take;
+	return top + 1;
+}
+
+//links the slots of a magazine from index from on into one batch and gives it back to the pool
+static void ArenaMagazineGiveBack(ArenaPool* pool, ArenaMagazine* magazine, unsigned from) {
+	if (magazine->count <= from) {
+		return;
+	}
+	uint32_t next = 0;
+	for (unsigned i = from; i < magazine->count; i++) {
+		uint32_t index = ((uintptr_t)magazine->slots[i] - pool->arena->first_ptr) / pool->slot + 1;
+		ArenaPoolLinks(pool, index)[0] = next;
+		next = index;
+	}
+	magazine->count = from;
+	ArenaPoolPushBatch(pool, next);
+}
+
+//takes a slot for ArenaPoolGet from the free batches, topping the magazine up to half full on the way if there is one, and from the bump if they run out
+static void* ArenaPoolRefill(ArenaPool* pool, ArenaMagazine* magazine) {
+	void* ptr = NULL;
+	unsigned want = magazine ? ARENA_MAGAZINE_SIZE / 2 : 0;
+	while (!ptr || (magazine && magazine->count < want)) {
+		uint32_t rest = ArenaPoolPopBatch(pool);
+		if (!rest) {
+			break;
+		}
+		if (!ptr) {
+			ptr = ArenaPoolLinks(pool, rest);
+			rest = ArenaPoolLinks(pool, rest)[0];
+		}
+		for (; rest && magazine && magazine->count < ARENA_MAGAZINE_SIZE; rest = ArenaPoolLinks(pool, rest)[0]) {
+			magazine->slots[magazine->count++] = ArenaPoolLinks(pool, rest);
+		}
+		//whatever didn't fit goes back as a shorter batch
+		if (rest) {
+			ArenaPoolPushBatch(pool, rest);
+			break;
+		}
+	}
+	unsigned have = magazine ? magazine->count : 0;
+	if (!ptr || have < want) {
+		unsigned got;
+		uint32_t first = ArenaPoolBump(pool, want - have + !ptr, &got);
+		for (unsigned i = 0; i < got; i++) {
+			if (!ptr) {
+				ptr = ArenaPoolLinks(pool, first + i);
+			} else {
+				magazine->slots[magazine->count++] = ArenaPoolLinks(pool, first + i);
+			}
+		}
+	}
+	return ptr;
+}
+
+//takes a zeroed slot from the pool, or NULL if every slot is in use. With a magazine most calls are served from it without touching the pool, without one every call is a CAS
+void* ArenaPoolGet(ArenaPool* pool, ArenaMagazine* magazine) {
+	void* ptr = magazine && magazine->count ? magazine->slots[--magazine->count] : ArenaPoolRefill(pool, magazine);
+	if (ptr) {
+		memset(ptr, 0, pool->arena->elem_size);
+	}
+	return ptr;
+}
+
+//gives a slot back. With a magazine it is kept there and half the magazine goes back to the pool in one batch when it is full
+void ArenaPoolPut(ArenaPool* pool, ArenaMagazine* magazine, void* ptr) {
+	assert((uintptr_t)ptr >= pool->arena->first_ptr && ((uintptr_t)ptr - pool->arena->first_ptr) % pool->slot == 0);
+	if (!magazine) {
+		uint32_t index = ((uintptr_t)ptr - pool->arena->first_ptr) / pool->slot + 1;
+		ArenaPoolLinks(pool, index)[0] = 0;
+		ArenaPoolPushBatch(pool, index);
+		return;
+	}
+	if (magazine->count == ARENA_MAGAZINE_SIZE) {
+		ArenaMagazineGiveBack(pool, magazine, ARENA_MAGAZINE_SIZE / 2);
+	}
+	magazine->slots[magazine->count++] = ptr;
+}
+
+//gives every slot in a magazine back to the pool, before the thread that owns it exits
+void ArenaMagazineFlush(ArenaPool* pool, ArenaMagazine* magazine) {
+	ArenaMagazineGiveBack(pool, magazine, 0);
+}
+
+//gives a registered arena a name for ArenaReport. Longer names are cut to ARENA_NAME_SIZE - 1 characters. Returns -1 if the arena isn't in the registry, which happens to sub-arenas and once ARENA_MAX_REGISTERED arenas are live
+int ArenaSetName(Arena* arena, const char* name) {
+	for (int i = 0; i < ARENA_MAX_REGISTERED; i++) {
+		if (__atomic_load_n(&arena_registry[i], __ATOMIC_RELAXED) == arena) {
+			size_t len = strnlen(name, ARENA_NAME_SIZE - 1);
+			memcpy(arena_registry_names[i], name, len);
+			arena_registry_names[i][len] = 0;
+			if (arena->stats) {
+				memcpy(arena->stats->name, arena_registry_names[i], ARENA_NAME_SIZE);
+			}
+			return 0;
+		}
+	}
+	return -1;
+}
+
+//appends s to a report line, padded with spaces to width. ArenaReport builds its lines by hand since printf isn't safe in a signal handler
+static size_t ArenaReportStr(char* line, size_t at, const char* s, size_t width) {
+	size_t len = 0;
+	for (; s[len] && at + len < 200; len++) {
+		line[at + len] = s[len];
+	}
+	for (; len < width; len++) {
+		line[at + len] = ' ';
+	}
+	return at + len;
+}
+
+//appends value right aligned in width characters, in base 10 or 16
+static size_t ArenaReportNum(char* line, size_t at, uint64_t value, size_t width, unsigned base) {
+	char digits[24];
+	size_t count = 0;
+	do {
+		digits[count++] = "0123456789abcdef"[value % base];
+		value /= base;
+	} while (value);
+	for (size_t i = count; i < width; i++) {
+		line[at++] = ' ';
+	}
+	while (count) {
+		line[at++] = digits[--count];
+	}
+	return at;
+}
+
+//counts the pages of [start, start + size) that are committed, faulted in at some point and either in RAM or swapped out, using /proc/self/pagemap. Returns resident instead if pagemap can't be read
+static size_t ArenaCommittedPages(uintptr_t start, size_t size, size_t resident) {
+	long page_size = getpagesize();
+	int fd = open("/proc/self/pagemap", O_RDONLY);
+	if (fd == -1) {
+		return resident;
+	}
+	size_t pages = size / page_size;
+	size_t committed = 0;
+	uint64_t entries[512];
+	for (size_t done = 0; done < pages; done += 512) {
+		size_t count = pages - done < 512 ? pages - done : 512;
+		off_t offset = (off_t)((start / page_size + done) * sizeof(uint64_t));
+		if (pread(fd, entries, count * sizeof(uint64_t), offset) != (ssize_t)(count * sizeof(uint64_t))) {
+			close(fd);
+			return resident;
+		}
+		for (size_t i = 0; i < count; i++) {
+			//bit 63 is present, bit 62 swapped
+			committed += (entries[i] >> 62) != 0;
+		}
+	}
+	close(fd);
+	return committed;
+}
+
+//counts the pages of [start, start + size) that are in RAM right now with mincore
+static size_t ArenaResidentPages(uintptr_t start, size_t size) {
+	long page_size = getpagesize();
+	size_t pages = size / page_size;
+	size_t resident = 0;
+	unsigned char vec[4096];
+	for (size_t done = 0; done < pages; done += sizeof(vec)) {
+		size_t count = pages - done < sizeof(vec) ? pages - done : sizeof(vec);
+		if (mincore((void*)(start + done * page_size), count * page_size, vec) != 0) {
+			break;
+		}
+		for (size_t i = 0; i < count; i++) {
+			resident += vec[i] & 1;
+		}
+	}
+	return resident;
+}
+
+//writes one line per registered arena to fd: address, name, reserved, committed, resident and used KiB, the number of holes left by ArenaDrop and the share of the used bytes they waste, then a line of totals and the number of arenas that didn't fit in the registry. Side arenas like free lists and bitmaps aren't listed, only the arenas they belong to. Only uses write, open, pread and mincore, so it is safe to call from a signal handler, see ArenaReportOnSignal. It takes no lock, so it is safe against an ArenaRelease on the thread it interrupts, which takes the arena out of the registry before unmapping it, but not against one running on another thread at the same time: the mincore check only skips arenas that are already gone, one unmapped between that check and reading its header still faults. Callers that release arenas from other threads have to keep them alive while a report runs. Returns the number of arenas listed
+int ArenaReport(int fd) {
+	long page_size = getpagesize();
+	char line[256];
+	size_t at = 0;
+	at = ArenaReportStr(line, at, "arena", 16);
+	at = ArenaReportStr(line, at, "name", ARENA_NAME_SIZE - 1);
+	at = ArenaReportStr(line, at, "   reserved  committed   resident       used      holes  frag%\n", 0);
+	ssize_t unused = write(fd, line, at);
+	uint64_t totals[4] = {0, 0, 0, 0};
+	int listed = 0;
+	for (int i = 0; i < ARENA_MAX_REGISTERED; i++) {
+		Arena* arena = __atomic_load_n(&arena_registry[i], __ATOMIC_ACQUIRE);
+		unsigned char header;
+		if (!arena || mincore(arena, 1, &header) != 0) {
+			continue;
+		}
+		size_t slot = arena->one_type && arena->elem_size ? ArenaSlotSize(arena) : 0;
+		uint64_t used = (arena->ptr - arena->first_ptr) + (arena->end_ptr - arena->high_ptr);
+		if (arena->magic == ARENA_SHARED_MAGIC) {
+			used = arena->shared_top - (arena->first_ptr - arena->base);
+		}
+		//side arenas are taken out of the header before they are unmapped, see ArenaReleaseSide
+		uint64_t holes = 0;
+		Arena* free_list = __atomic_load_n(&arena->free_list, __ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&arena->occupancy, __ATOMIC_ACQUIRE)) {
+			holes = arena->holes;
+		} else if (free_list && mincore(free_list, 1, &header) == 0) {
+			holes = (free_list->ptr - free_list->first_ptr) / sizeof(void*);
+		}
+		uint64_t resident = ArenaResidentPages((uintptr_t)arena, arena->size);
+		uint64_t committed = ArenaCommittedPages((uintptr_t)arena, arena->size, resident);
+		uint64_t values[4] = {arena->size, committed * page_size, resident * page_size, used};
+		at = 0;
+		line[at++] = '0';
+		line[at++] = 'x';
+		at = ArenaReportNum(line, at, (uintptr_t)arena, 12, 16);
+		line[at++] = ' ';
+		line[at++] = ' ';
+		at = ArenaReportStr(line, at, arena_registry_names[i][0] ? arena_registry_names[i] : "-", ARENA_NAME_SIZE - 1);
+		for (int v = 0; v < 4; v++) {
+			line[at++] = ' ';
+			at = ArenaReportNum(line, at, values[v] / 1024, 10, 10);
+			totals[v] += values[v];
+		}
+		at = ArenaReportNum(line, at, holes, 11, 10);
+		at = ArenaReportNum(line, at, used ? holes * slot * 100 / used : 0, 7, 10);
+		line[at++] = '\n';
+		unused = write(fd, line, at);
+		listed++;
+	}
+	at = ArenaReportStr(line, 0, "total", 16 + ARENA_NAME_SIZE - 1);
+	for (int v = 0; v < 4; v++) {
+		line[at++] = ' ';
+		at = ArenaReportNum(line, at, totals[v] / 1024, 10, 10);
+	}
+	line[at++] = '\n';
+	unused = write(fd, line, at);
+	uint64_t dropped = __atomic_load_n(&arena_registry_dropped, __ATOMIC_RELAXED);
+	if (dropped) {
+		at = ArenaReportNum(line, 0, dropped, 0, 10);
+		at = ArenaReportStr(line, at, " arenas created while the registry was full are not listed\n", 0);
+		unused = write(fd, line, at);
+	}
+	(void)unused;
+	return listed;
+}
+
+static int arena_report_fd = -1;
+
+static void ArenaReportSignal(int sig) {
+	(void)sig;
+	int saved = errno;
+	ArenaReport(arena_report_fd);
+	errno = saved;
+}
+
+//makes the process write ArenaReport to fd whenever it gets sig, so a running process can be inspected with kill -USR1. Returns -1 if the handler can't be installed
+int ArenaReportOnSignal(int sig, int fd) {
+	arena_report_fd = fd;
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = ArenaReportSignal;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART;
+	return sigaction(sig, &sa, NULL);
+}
+
+static ArenaStatsPage* arena_stats_page;
+static pthread_once_t arena_stats_once = PTHREAD_ONCE_INIT;
+
+//name of the stats page of process pid
+static void ArenaStatsPath(char* path, size_t size, long pid) {
+	snprintf(path, size, "/arenastats.%ld", pid);
+}
+
+static void ArenaStatsCreate(void) {
+	char path[64];
+	ArenaStatsPath(path, sizeof(path), (long)getpid());
+	int fd = shm_open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		perror("couldn't create arena stats page");
+		return;
+	}
+	if (ftruncate(fd, sizeof(ArenaStatsPage)) != 0) {
+		perror("couldn't size arena stats page");
+		close(fd);
+		shm_unlink(path);
+		return;
+	}
+	ArenaStatsPage* page = (ArenaStatsPage*) mmap(NULL, sizeof(ArenaStatsPage), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (page == (ArenaStatsPage*)MAP_FAILED) {
+		perror("couldn't map arena stats page");
+		shm_unlink(path);
+		return;
+	}
+	page->pid = getpid();
+	page->slots = ARENA_MAX_REGISTERED;
+	__atomic_store_n(&page->magic, ARENA_STATS_MAGIC, __ATOMIC_RELEASE);
+	arena_stats_page = page;
+}
+
+//publishes the counters of arena in the shared memory stats page of the process, /arenastats.<pid>, which is created on the first call. From then on every push and drop keeps its used bytes, high water mark, push count and failed pushes up to date for arenatop to read. The name comes from ArenaSetName. Returns -1 for shared memory arenas, or if the page can't be created or every slot is taken
+int ArenaPublishStats(Arena* arena) {
+	//the header of a shared arena is mapped by every process, and the stats pointer only means something to this one
+	if (!arena || arena->magic == ARENA_SHARED_MAGIC) {
+		return -1;
+	}
+	if (arena->stats) {
+		return 0;
+	}
+	pthread_once(&arena_stats_once, ArenaStatsCreate);
+	if (!arena_stats_page) {
+		return -1;
+	}
+	for (int i = 0; i < ARENA_MAX_REGISTERED; i++) {
+		ArenaStats* stats = &arena_stats_page->stats[i];
+		uint64_t expected = 0;
+		if (__atomic_load_n(&stats->arena, __ATOMIC_RELAXED) ||
+			!__atomic_compare_exchange_n(&stats->arena, &expected, (uint64_t)(uintptr_t)arena, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+			continue;
+		}
+		__atomic_store_n(&stats->pushes, (uint64_t)0, __ATOMIC_RELAXED);
+		__atomic_store_n(&stats->failures, (uint64_t)0, __ATOMIC_RELAXED);
+		__atomic_store_n(&stats->high_water, (uint64_t)0, __ATOMIC_RELAXED);
+		stats->name[0] = 0;
+		for (int j = 0; j < ARENA_MAX_REGISTERED; j++) {
+			if (__atomic_load_n(&arena_registry[j], __ATOMIC_RELAXED) == arena) {
+				memcpy(stats->name, arena_registry_names[j], ARENA_NAME_SIZE);
+			}
+		}
+		__atomic_store_n(&stats->generation, stats->generation + 1, __ATOMIC_RELEASE);
+		arena->stats = stats;
+		ArenaStatsUpdate(arena, 0);
+		return 0;
+	}
+	fprintf(stderr, "ArenaPublishStats() can't publish more than %d arenas\n", ARENA_MAX_REGISTERED);
+	return -1;
+}
+
+//removes the name of the stats page of this process, before it exits. arenatop sessions that have it open keep seeing the last values
+int ArenaUnlinkStats(void) {
+	char path[64];
+	ArenaStatsPath(path, sizeof(path), (long)getpid());
+	return shm_unlink(path);
+}
+
+//maps the stats page of process pid read only, for arenatop. Returns NULL if the process hasn't published any stats
+const ArenaStatsPage* ArenaAttachStats(long pid) {
+	char path[64];
+	ArenaStatsPath(path, sizeof(path), pid);
+	int fd = shm_open(path, O_RDONLY, 0);
+	if (fd == -1) {
+		return NULL;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(ArenaStatsPage)) {
+		close(fd);
+		return NULL;
+	}
+	ArenaStatsPage* page = (ArenaStatsPage*) mmap(NULL, sizeof(ArenaStatsPage), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (page == (ArenaStatsPage*)MAP_FAILED) {
+		return NULL;
+	}
+	if (__atomic_load_n(&page->magic, __ATOMIC_ACQUIRE) != ARENA_STATS_MAGIC) {
+		munmap(page, sizeof(ArenaStatsPage));
+		return NULL;
+	}
+	return page;
 }
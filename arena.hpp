@@ -0,0 +1,303 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include "arena.c"
+
+namespace arena {
+
+//gives size bytes at ptr back to the arena if they are the last thing pushed, otherwise they stay until the arena is dropped to below them
+inline void drop_if_top(::Arena* raw, void* ptr, std::size_t size) {
+	std::uintptr_t end = (reinterpret_cast<std::uintptr_t>(ptr) + size + raw->alignment - 1) & ~(raw->alignment - 1);
+	if (end == raw->ptr) {
+		ArenaDropTo(raw, ptr);
+	}
+}
+
+//single type Arena of T with the slot size and alignment known at compile time, so the common push and drop paths are inlined with constant masks and memset lengths. Holes, occupancy bitmaps and remote drops still go through the C functions. Move-only, the arena is released when it goes out of scope
+template <typename T, std::size_t Align = alignof(T)>
+class Arena {
+public:
+	static_assert((Align & (Align - 1)) == 0, "Align must be a power of 2");
+	static_assert(Align >= alignof(T), "Align must be at least alignof(T)");
+	//size of one slot, sizeof(T) rounded up to Align
+	static constexpr std::size_t slot = (sizeof(T) + Align - 1) & ~(Align - 1);
+
+	explicit Arena(unsigned pages) : raw_(ArenaAlloc(pages)) {
+		raw_->one_type = true;
+		raw_->elem_size = slot;
+		ArenaSetAlignment(raw_, Align);
+		//the live elements have to be known to destroy them with the arena
+		if (!std::is_trivially_destructible<T>::value) {
+			ArenaTrackOccupancy(raw_);
+		}
+	}
+
+	~Arena() {
+		if (!raw_) {
+			return;
+		}
+		if (!std::is_trivially_destructible<T>::value) {
+			ArenaForEach(raw_, destroy, nullptr);
+		}
+		ArenaRelease(raw_);
+	}
+
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+
+	Arena(Arena&& other) noexcept : raw_(other.raw_) {
+		other.raw_ = nullptr;
+	}
+
+	Arena& operator=(Arena&& other) noexcept {
+		if (this != &other) {
+			this->~Arena();
+			raw_ = other.raw_;
+			other.raw_ = nullptr;
+		}
+		return *this;
+	}
+
+	//zeroed slot, like ArenaPush on a single type Arena. NULL if the arena is full. Only for types that can start out as zero bytes without a constructor, use emplace for the rest
+	T* push() {
+		static_assert(std::is_trivially_default_constructible<T>::value, "push hands out zeroed memory, use emplace to construct T");
+		void* mem = take();
+		if (mem) {
+			std::memset(mem, 0, slot);
+		}
+		return static_cast<T*>(mem);
+	}
+
+	//constructs a T in a new slot. NULL if the arena is full. If the constructor throws the slot is given back before the exception goes on
+	template <typename... Args>
+	T* emplace(Args&&... args) {
+		void* mem = take();
+		if (!mem) {
+			return nullptr;
+		}
+		try {
+			return new (mem) T(std::forward<Args>(args)...);
+		} catch (...) {
+			give_back(mem);
+			throw;
+		}
+	}
+
+	//destroys the element and gives its slot back
+	void drop(T* elem) {
+		elem->~T();
+		give_back(elem);
+	}
+
+	//number of live elements
+	std::size_t count() const {
+		return ArenaLiveCount(raw_);
+	}
+
+	//the C arena, for the rest of the API
+	::Arena* get() const {
+		return raw_;
+	}
+
+private:
+	//true while the arena is a plain bump with no holes to fill, no remote drops to take and nothing else to keep up to date
+	bool fast() const {
+		return !raw_->to_free && !raw_->occupancy && !raw_->owned && !raw_->stats && !__atomic_load_n(&raw_->remote_free, __ATOMIC_RELAXED);
+	}
+
+	void* take() {
+		std::uintptr_t ptr = raw_->ptr;
+		if (fast() && ptr + slot + Align < raw_->high_ptr) {
+			//ptr stays aligned since slot is a multiple of Align
+			raw_->ptr = ptr + slot;
+			if (raw_->ptr > raw_->touch_at) {
+				ArenaTouchAhead(raw_);
+			}
+			return reinterpret_cast<void*>(ptr);
+		}
+		return ArenaPush(raw_, slot);
+	}
+
+	//gives a slot back without destroying anything in it
+	void give_back(void* mem) {
+		if (fast() && reinterpret_cast<std::uintptr_t>(mem) + slot == raw_->ptr) {
+			raw_->ptr = reinterpret_cast<std::uintptr_t>(mem);
+			return;
+		}
+		ArenaDrop(raw_, mem);
+	}
+
+	static void destroy(void* elem, void*) {
+		static_cast<T*>(elem)->~T();
+	}
+
+	::Arena* raw_;
+};
+
+//untyped arena that objects of any type can be emplaced in. Move-only, the arena is released when it goes out of scope
+class ArenaRef {
+public:
+	explicit ArenaRef(unsigned pages) : raw_(ArenaAlloc(pages)) {}
+
+	//takes ownership of an arena created with the C API
+	explicit ArenaRef(::Arena* raw) : raw_(raw) {}
+
+	~ArenaRef() {
+		if (raw_) {
+			ArenaRelease(raw_);
+		}
+	}
+
+	ArenaRef(const ArenaRef&) = delete;
+	ArenaRef& operator=(const ArenaRef&) = delete;
+
+	ArenaRef(ArenaRef&& other) noexcept : raw_(other.raw_) {
+		other.raw_ = nullptr;
+	}
+
+	ArenaRef& operator=(ArenaRef&& other) noexcept {
+		if (this != &other) {
+			this->~ArenaRef();
+			raw_ = other.raw_;
+			other.raw_ = nullptr;
+		}
+		return *this;
+	}
+
+	void* push(std::size_t size) {
+		return ArenaPush(raw_, size);
+	}
+
+	//constructs a T aligned to alignof(T). NULL if the arena is full. Types with a destructor get it registered with ArenaPushWithCleanup, so it runs when the arena is dropped to below them or released. If the constructor throws the cleanup is taken off again and the arena dropped back to where T started
+	template <typename T, typename... Args>
+	T* emplace(Args&&... args) {
+		bool cleanup = !std::is_trivially_destructible<T>::value;
+		void* mem = cleanup ? ArenaPushAlignedWithCleanup(raw_, sizeof(T), alignof(T), destroy<T>) : ArenaPushAligned(raw_, sizeof(T), alignof(T));
+		if (!mem) {
+			return nullptr;
+		}
+		try {
+			return new (mem) T(std::forward<Args>(args)...);
+		} catch (...) {
+			if (cleanup) {
+				//the record was just linked in, so it is the newest one
+				raw_->cleanups = raw_->cleanups->next;
+			}
+			ArenaDropTo(raw_, mem);
+			throw;
+		}
+	}
+
+	//position to come back to with drop_to
+	void* mark() const {
+		return reinterpret_cast<void*>(raw_->ptr);
+	}
+
+	void drop_to(void* pos) {
+		ArenaDropTo(raw_, pos);
+	}
+
+	::Arena* get() const {
+		return raw_;
+	}
+
+	//hands the arena back to the caller, who has to ArenaRelease it
+	::Arena* release() {
+		::Arena* raw = raw_;
+		raw_ = nullptr;
+		return raw;
+	}
+
+private:
+	template <typename T>
+	static void destroy(void* obj) {
+		static_cast<T*>(obj)->~T();
+	}
+
+	::Arena* raw_;
+};
+
+//std::pmr::memory_resource over an arena, so pmr containers and strings can live in it. Allocation is a monotonic ArenaPush, deallocation only gives memory back when the block is on top of the arena, which covers a vector regrowing or a temporary string. Does not own the arena, which has to outlive every container using it
+class ArenaResource : public std::pmr::memory_resource {
+public:
+	explicit ArenaResource(::Arena* raw) noexcept : raw_(raw) {}
+	explicit ArenaResource(const ArenaRef& ref) noexcept : raw_(ref.get()) {}
+
+	::Arena* get() const noexcept {
+		return raw_;
+	}
+
+private:
+	void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+		void* mem = ArenaPushAligned(raw_, bytes ? bytes : 1, alignment);
+		if (!mem) {
+			throw std::bad_alloc();
+		}
+		return mem;
+	}
+
+	void do_deallocate(void* ptr, std::size_t bytes, std::size_t) override {
+		drop_if_top(raw_, ptr, bytes ? bytes : 1);
+	}
+
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+		return this == &other;
+	}
+
+	::Arena* raw_;
+};
+
+//classic STL allocator over an arena, for containers that take an allocator template parameter. Behaves like ArenaResource, and copies compare equal when they use the same arena
+template <typename T>
+class ArenaAllocator {
+public:
+	using value_type = T;
+
+	explicit ArenaAllocator(::Arena* raw) noexcept : raw_(raw) {}
+
+	template <typename U>
+	ArenaAllocator(const ArenaAllocator<U>& other) noexcept : raw_(other.get()) {}
+
+	T* allocate(std::size_t n) {
+		if (n > SIZE_MAX / sizeof(T)) {
+			throw std::bad_array_new_length();
+		}
+		void* mem = ArenaPushAligned(raw_, n ? n * sizeof(T) : 1, alignof(T));
+		if (!mem) {
+			throw std::bad_alloc();
+		}
+		return static_cast<T*>(mem);
+	}
+
+	void deallocate(T* ptr, std::size_t n) noexcept {
+		drop_if_top(raw_, ptr, n ? n * sizeof(T) : 1);
+	}
+
+	::Arena* get() const noexcept {
+		return raw_;
+	}
+
+private:
+	::Arena* raw_;
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) noexcept {
+	return a.get() == b.get();
+}
+
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) noexcept {
+	return a.get() != b.get();
+}
+
+}
+
+#endif
@@ -0,0 +1,81 @@
+//arenatop shows the arenas a process published with ArenaPublishStats, refreshed every interval
+//usage: arenatop <pid> [interval ms] [refreshes]
+//It only maps the stats page read only and never signals or stops the process, so watching it costs the process nothing
+#include "arena.c"
+#include <time.h>
+
+typedef struct TopRow {
+	uint64_t arena;
+	uint64_t generation;
+	uint64_t pushes;
+	uint64_t failures;
+} TopRow;
+
+static double now_seconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s <pid> [interval ms] [refreshes]\n", argv[0]);
+		return 1;
+	}
+	long pid = atol(argv[1]);
+	long interval = argc > 2 ? atol(argv[2]) : 1000;
+	long refreshes = argc > 3 ? atol(argv[3]) : -1;
+	if (interval <= 0) {
+		interval = 1000;
+	}
+	const ArenaStatsPage* page = ArenaAttachStats(pid);
+	if (!page) {
+		fprintf(stderr, "arenatop: process %ld has no arena stats page\n", pid);
+		return 1;
+	}
+	bool tty = isatty(STDOUT_FILENO);
+	static TopRow last[ARENA_MAX_REGISTERED];
+	double last_time = now_seconds();
+	for (long refresh = 0; refreshes < 0 || refresh < refreshes; refresh++) {
+		struct timespec pause = {interval / 1000, (interval % 1000) * 1000000};
+		nanosleep(&pause, NULL);
+		double now = now_seconds();
+		double elapsed = now - last_time;
+		last_time = now;
+		if (tty) {
+			printf("\033[H\033[2J");
+		}
+		printf("pid %ld, %d arena slots, every %ld ms\n", pid, ARENA_MAX_REGISTERED, interval);
+		printf("%-31s %14s %10s %10s %12s %10s\n", "name", "arena", "used KiB", "high KiB", "pushes/s", "failures");
+		int shown = 0;
+		for (int i = 0; i < ARENA_MAX_REGISTERED; i++) {
+			const ArenaStats* stats = &page->stats[i];
+			TopRow row;
+			row.arena = __atomic_load_n(&stats->arena, __ATOMIC_ACQUIRE);
+			if (!row.arena) {
+				last[i].arena = 0;
+				continue;
+			}
+			row.generation = __atomic_load_n(&stats->generation, __ATOMIC_ACQUIRE);
+			row.pushes = __atomic_load_n(&stats->pushes, __ATOMIC_RELAXED);
+			row.failures = __atomic_load_n(&stats->failures, __ATOMIC_RELAXED);
+			uint64_t used = __atomic_load_n(&stats->used, __ATOMIC_RELAXED);
+			uint64_t high_water = __atomic_load_n(&stats->high_water, __ATOMIC_RELAXED);
+			char name[ARENA_NAME_SIZE];
+			memcpy(name, stats->name, ARENA_NAME_SIZE);
+			name[ARENA_NAME_SIZE - 1] = 0;
+			//a slot that was given to another arena since the last refresh starts its rate over
+			bool same = last[i].arena == row.arena && last[i].generation == row.generation;
+			double rate = same && row.pushes >= last[i].pushes ? (row.pushes - last[i].pushes) / elapsed : 0;
+			printf("%-31s %#14lx %10lu %10lu %12.0f %10lu\n", name[0] ? name : "-", (unsigned long)row.arena,
+				(unsigned long)(used / 1024), (unsigned long)(high_water / 1024), rate, (unsigned long)row.failures);
+			last[i] = row;
+			shown++;
+		}
+		if (!shown) {
+			printf("no arenas published\n");
+		}
+		fflush(stdout);
+	}
+	return 0;
+}
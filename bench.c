@@ -0,0 +1,1003 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "arena.c"
+
+
+/* -----------------------------------------------------------------------------
+ * Helpers
+ * -----------------------------------------------------------------------------*/
+
+static double now_seconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Opens a hardware or software counter for this thread, -1 if perf events
+ * are not available.
+ */
+static int perf_open(uint32_t type, uint64_t config) {
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static long long perf_read(int fd) {
+	long long value = -1;
+	if (fd == -1 || read(fd, &value, sizeof(value)) != sizeof(value)) {
+		return -1;
+	}
+	return value;
+}
+
+/* -----------------------------------------------------------------------------
+ * Benchmarks
+ * -----------------------------------------------------------------------------*/
+
+/* Cost of ArenaClone versus the size of the arena being cloned.
+ * The arena is filled completely before every clone. A full memcpy of the
+ * same bytes is shown for comparison, along with the cost of writing one
+ * long per page of the clone afterwards, which is where the copying happens.
+ */
+static void bench_ArenaClone(void) {
+	printf("bench_ArenaClone\n");
+	printf("%12s %14s %14s %16s\n", "arena bytes", "clone us", "memcpy us", "touch clone us");
+	long page_size = getpagesize();
+	for (unsigned pages = 16; pages <= 65536; pages *= 4) {
+		Arena* arena = ArenaAllocMemfd(pages);
+		size_t bytes = arena->end_ptr - arena->first_ptr - 2 * arena->alignment;
+		char* data = (char*)ArenaPush(arena, bytes);
+		memset(data, 0xab, bytes);
+
+		double start = now_seconds();
+		Arena* clone = ArenaClone(arena);
+		double clone_time = now_seconds() - start;
+
+		Arena* copy = ArenaAlloc(pages);
+		start = now_seconds();
+		memcpy((void*)copy->first_ptr, data, bytes);
+		double copy_time = now_seconds() - start;
+
+		start = now_seconds();
+		for (uintptr_t p = clone->first_ptr; p < clone->ptr; p += page_size) {
+			*(long*)(p & ~(page_size - 1)) += 1;
+		}
+		double touch_time = now_seconds() - start;
+
+		printf("%12zu %14.1f %14.1f %16.1f\n", bytes, clone_time * 1e6, copy_time * 1e6, touch_time * 1e6);
+		ArenaRelease(copy);
+		ArenaRelease(clone);
+		ArenaRelease(arena);
+	}
+}
+
+/* Walking all live elements of a pool with a quarter of its slots dropped.
+ * The baseline scans from first_ptr to ptr and skips zeroed slots, which is
+ * all that was possible before ArenaForEach.
+ */
+typedef struct BenchElem {
+	long key;
+	long payload[7];
+} BenchElem;
+
+static void bench_visit(void* elem, void* ctx) {
+	*(long*)ctx += ((BenchElem*)elem)->key;
+}
+
+static void bench_visit_atomic(void* elem, void* ctx) {
+	__atomic_fetch_add((long*)ctx, ((BenchElem*)elem)->key, __ATOMIC_RELAXED);
+}
+
+static void bench_run(void* first, size_t count, void* ctx) {
+	BenchElem* elems = (BenchElem*)first;
+	long sum = 0;
+	for (size_t i = 0; i < count; i++) {
+		sum += elems[i].key;
+	}
+	*(long*)ctx += sum;
+}
+
+static void bench_ArenaForEach(void) {
+	printf("bench_ArenaForEach\n");
+	size_t count = 1 << 20;
+	Arena* arena = ArenaAlloc((count * sizeof(BenchElem)) / getpagesize() + 2);
+	arena->one_type = true;
+	arena->elem_size = sizeof(BenchElem);
+	ArenaTrackOccupancy(arena);
+	BenchElem* first = (BenchElem*)ArenaPush(arena, arena->elem_size);
+	for (size_t i = 1; i < count; i++) {
+		ArenaPush(arena, arena->elem_size);
+	}
+	for (size_t i = 0; i < count; i++) {
+		first[i].key = i + 1;
+	}
+	uint64_t seed = 42;
+	for (size_t i = 0; i < count / 4; i++) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		size_t index = (seed >> 33) % (count - 1);
+		if (ArenaIsLive(arena, &first[index])) {
+			ArenaPop(arena, &first[index]);
+		}
+	}
+	const int rounds = 20;
+	long sum = 0;
+	double start = now_seconds();
+	for (int r = 0; r < rounds; r++) {
+		for (BenchElem* e = first; (uintptr_t)e < arena->ptr; e++) {
+			if (e->key != 0) {
+				sum += e->key;
+			}
+		}
+	}
+	double scan = (now_seconds() - start) / rounds;
+	long check = sum;
+	sum = 0;
+	start = now_seconds();
+	for (int r = 0; r < rounds; r++) {
+		ArenaForEach(arena, bench_visit, &sum);
+	}
+	double each = (now_seconds() - start) / rounds;
+	assert(sum == check);
+	sum = 0;
+	start = now_seconds();
+	for (int r = 0; r < rounds; r++) {
+		ArenaForEachRun(arena, bench_run, &sum);
+	}
+	double runs = (now_seconds() - start) / rounds;
+	assert(sum == check);
+	sum = 0;
+	start = now_seconds();
+	for (int r = 0; r < rounds; r++) {
+		ArenaForEachParallel(arena, bench_visit_atomic, &sum, 0);
+	}
+	double parallel = (now_seconds() - start) / rounds;
+	assert(sum == check);
+	printf("%zu slots, %zu live\n", count, ArenaLiveCount(arena));
+	printf("%24s %10.2f ms\n", "zero check scan", scan * 1e3);
+	printf("%24s %10.2f ms\n", "ArenaForEach", each * 1e3);
+	printf("%24s %10.2f ms\n", "ArenaForEachRun", runs * 1e3);
+	printf("%24s %10.2f ms\n", "ArenaForEachParallel", parallel * 1e3);
+	ArenaRelease(arena);
+}
+
+/* Traversing a linked list whose nodes were linked in random order, before
+ * and after ArenaReorderBy puts them in traversal order. Cache misses are
+ * read from perf events where the kernel allows it.
+ */
+typedef struct BenchNode {
+	size_t next;
+	size_t rank;
+	long payload[6];
+} BenchNode;
+
+static uint64_t bench_rank_key(const void* elem, void* ctx) {
+	(void)ctx;
+	return ((const BenchNode*)elem)->rank;
+}
+
+typedef struct BenchRelocation {
+	BenchNode* base;
+	size_t* new_index;
+} BenchRelocation;
+
+static void bench_record_move(void* from, void* to, void* ctx) {
+	BenchRelocation* relocation = (BenchRelocation*)ctx;
+	relocation->new_index[(BenchNode*)from - relocation->base] = (BenchNode*)to - relocation->base;
+}
+
+static long bench_traverse(BenchNode* nodes, size_t head, size_t count, long long* misses) {
+	int fd = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+	long long before = perf_read(fd);
+	long sum = 0;
+	size_t index = head;
+	for (size_t i = 0; i < count; i++) {
+		sum += nodes[index].payload[0];
+		index = nodes[index].next;
+	}
+	long long after = perf_read(fd);
+	*misses = before == -1 ? -1 : after - before;
+	if (fd != -1) {
+		close(fd);
+	}
+	return sum;
+}
+
+static void bench_ArenaReorder(void) {
+	printf("bench_ArenaReorder\n");
+	size_t count = 1 << 20;
+	Arena* arena = ArenaAlloc((count * sizeof(BenchNode)) / getpagesize() + 2);
+	arena->one_type = true;
+	arena->elem_size = sizeof(BenchNode);
+	BenchNode* nodes = (BenchNode*)ArenaPush(arena, arena->elem_size);
+	for (size_t i = 1; i < count; i++) {
+		ArenaPush(arena, arena->elem_size);
+	}
+	// Link the nodes in a random order.
+	Arena* scratch = ArenaAlloc((count * sizeof(size_t) * 2) / getpagesize() + 2);
+	size_t* perm = (size_t*)ArenaPush(scratch, count * sizeof(size_t));
+	for (size_t i = 0; i < count; i++) {
+		perm[i] = i;
+	}
+	uint64_t seed = 7;
+	for (size_t i = count - 1; i > 0; i--) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		size_t j = (seed >> 33) % (i + 1);
+		size_t tmp = perm[i];
+		perm[i] = perm[j];
+		perm[j] = tmp;
+	}
+	for (size_t i = 0; i < count; i++) {
+		nodes[perm[i]].next = perm[(i + 1) % count];
+		nodes[perm[i]].rank = i;
+		nodes[perm[i]].payload[0] = i;
+	}
+	size_t head = perm[0];
+	long long misses_before, misses_after;
+	double start = now_seconds();
+	long sum = bench_traverse(nodes, head, count, &misses_before);
+	double before = now_seconds() - start;
+
+	// Reorder into traversal order and patch the links from the relocations.
+	size_t* new_index = (size_t*)ArenaPush(scratch, count * sizeof(size_t));
+	for (size_t i = 0; i < count; i++) {
+		new_index[i] = i;
+	}
+	BenchRelocation relocation = {nodes, new_index};
+	start = now_seconds();
+	ArenaReorderBy(arena, bench_rank_key, bench_record_move, &relocation);
+	for (size_t i = 0; i < count; i++) {
+		nodes[i].next = new_index[nodes[i].next];
+	}
+	double reorder = now_seconds() - start;
+	head = new_index[head];
+	start = now_seconds();
+	long check = bench_traverse(nodes, head, count, &misses_after);
+	double after = now_seconds() - start;
+	assert(check == sum);
+	printf("%zu nodes of %zu bytes, reorder took %.1f ms\n", count, sizeof(BenchNode), reorder * 1e3);
+	if (misses_before == -1 || misses_after == -1) {
+		printf("%24s %10.2f ms (cache miss counter not available)\n", "random order", before * 1e3);
+		printf("%24s %10.2f ms\n", "after ArenaReorderBy", after * 1e3);
+	} else {
+		printf("%24s %10.2f ms %14lld cache misses\n", "random order", before * 1e3, misses_before);
+		printf("%24s %10.2f ms %14lld cache misses\n", "after ArenaReorderBy", after * 1e3, misses_after);
+	}
+	ArenaRelease(scratch);
+	ArenaRelease(arena);
+}
+
+/* Compacting a large pool with a third of its slots dropped, sequentially
+ * and with ArenaDefragParallel at several thread counts.
+ */
+static Arena* bench_holey_pool(size_t count) {
+	Arena* arena = ArenaAlloc((count * sizeof(BenchElem)) / getpagesize() + 2);
+	arena->one_type = true;
+	arena->elem_size = sizeof(BenchElem);
+	ArenaTrackOccupancy(arena);
+	BenchElem* first = (BenchElem*)ArenaPush(arena, arena->elem_size);
+	for (size_t i = 1; i < count; i++) {
+		ArenaPush(arena, arena->elem_size);
+	}
+	for (size_t i = 0; i < count; i++) {
+		first[i].key = i + 1;
+	}
+	for (size_t i = 0; i < count - 1; i += 3) {
+		ArenaDrop(arena, &first[i]);
+	}
+	return arena;
+}
+
+static void bench_ArenaDefragParallel(void) {
+	printf("bench_ArenaDefragParallel\n");
+	size_t count = 1 << 22;
+	Arena* arena = bench_holey_pool(count);
+	double start = now_seconds();
+	ArenaDefrag(arena);
+	printf("%24s %10.2f ms\n", "ArenaDefrag", (now_seconds() - start) * 1e3);
+	ArenaRelease(arena);
+	for (unsigned threads = 1; threads <= 8; threads *= 2) {
+		arena = bench_holey_pool(count);
+		start = now_seconds();
+		ArenaDefragParallel(arena, threads);
+		printf("%17s %2u thr %10.2f ms\n", "parallel", threads, (now_seconds() - start) * 1e3);
+		ArenaRelease(arena);
+	}
+}
+
+/* Page faults and push latency while filling a fresh arena, for a plain
+ * arena, one populated by ArenaAllocEx and one with touch-ahead.
+ */
+static int compare_double(const void* a, const void* b) {
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+	return x < y ? -1 : x > y;
+}
+
+static void bench_prefault_case(const char* name, unsigned flags, unsigned touch_ahead) {
+	size_t pages = 16384;
+	size_t push_size = 512;
+	size_t count = (pages - 1) * getpagesize() / push_size;
+	Arena* samples_arena = ArenaAlloc(count * sizeof(double) / getpagesize() + 2);
+	double* samples = (double*)ArenaPush(samples_arena, count * sizeof(double));
+	memset(samples, 0, count * sizeof(double));
+	struct rusage before, after;
+	getrusage(RUSAGE_SELF, &before);
+	double start = now_seconds();
+	Arena* arena = ArenaAllocEx(pages, flags);
+	if (!arena) {
+		printf("%24s could not be allocated\n", name);
+		ArenaRelease(samples_arena);
+		return;
+	}
+	if (touch_ahead) {
+		ArenaSetTouchAhead(arena, touch_ahead);
+	}
+	double setup = now_seconds() - start;
+	getrusage(RUSAGE_SELF, &after);
+	long setup_faults = after.ru_minflt - before.ru_minflt;
+	// Only the pushing thread's faults, the touch-ahead thread takes its own off the push path.
+	getrusage(RUSAGE_THREAD, &before);
+	for (size_t i = 0; i < count; i++) {
+		double t0 = now_seconds();
+		char* p = (char*)ArenaPush(arena, push_size);
+		p[0] = 1;
+		samples[i] = now_seconds() - t0;
+	}
+	getrusage(RUSAGE_THREAD, &after);
+	long push_faults = after.ru_minflt - before.ru_minflt;
+	qsort(samples, count, sizeof(double), compare_double);
+	printf("%24s %9.2f ms %9ld %9ld %9.0f ns %9.0f ns %9.0f ns\n", name, setup * 1e3, setup_faults, push_faults,
+		samples[count / 2] * 1e9, samples[count * 99 / 100] * 1e9, samples[count - 1] * 1e9);
+	ArenaRelease(arena);
+	ArenaRelease(samples_arena);
+}
+
+static void bench_ArenaPrefault(void) {
+	printf("bench_ArenaPrefault\n");
+	printf("%24s %12s %9s %9s %12s %12s %12s\n", "", "setup", "faults", "faults", "p50 push", "p99 push", "max push");
+	printf("%24s %12s %9s %9s\n", "", "", "setup", "pushes");
+	bench_prefault_case("plain", 0, 0);
+	bench_prefault_case("ARENA_POPULATE", ARENA_POPULATE, 0);
+	bench_prefault_case("ARENA_LOCK", ARENA_LOCK, 0);
+	bench_prefault_case("touch-ahead 64 pages", 0, 64);
+}
+
+/* Producer/consumer throughput through a ring arena, with 64 byte
+ * messages pushed and dropped in place.
+ */
+#define BENCH_RING_MESSAGES (1 << 22)
+
+static void* bench_ring_producer(void* arg) {
+	ArenaRing* ring = (ArenaRing*)arg;
+	for (long i = 0; i < BENCH_RING_MESSAGES; i++) {
+		long* msg;
+		while (!(msg = (long*)ArenaRingPush(ring, 64))) {
+			sched_yield();
+		}
+		msg[0] = i;
+		ArenaRingCommit(ring, 64);
+	}
+	return NULL;
+}
+
+static void bench_ArenaRing(void) {
+	printf("bench_ArenaRing\n");
+	for (unsigned pages = 1; pages <= 256; pages *= 16) {
+		ArenaRing* ring = ArenaRingAlloc(pages);
+		pthread_t producer;
+		double start = now_seconds();
+		pthread_create(&producer, NULL, bench_ring_producer, ring);
+		long sum = 0;
+		for (long i = 0; i < BENCH_RING_MESSAGES; i++) {
+			size_t available;
+			long* msg;
+			while (!(msg = (long*)ArenaRingPeek(ring, &available))) {
+				sched_yield();
+			}
+			sum += msg[0];
+			ArenaRingDrop(ring, 64);
+		}
+		pthread_join(producer, NULL);
+		double elapsed = now_seconds() - start;
+		printf("%14u pages %10.2f Mmsg/s %8.2f GB/s (sum %ld)\n", pages, BENCH_RING_MESSAGES / elapsed / 1e6,
+			BENCH_RING_MESSAGES * 64.0 / elapsed / 1e9, sum);
+		ArenaRingRelease(ring);
+	}
+}
+
+/* Per-tick garbage: every tick allocates a batch of small objects that the
+ * next tick still reads, then throws them away. malloc/free against
+ * double-buffered frame arenas, and the resident size of the frames after
+ * one spike tick with and without decommit.
+ */
+#define BENCH_TICKS 20000
+#define BENCH_TICK_OBJECTS 1000
+
+static void bench_ArenaFrames(void) {
+	printf("bench_ArenaFrames\n");
+	static void* previous[BENCH_TICK_OBJECTS];
+	static void* current[BENCH_TICK_OBJECTS];
+	long sum = 0;
+	double start = now_seconds();
+	for (int tick = 0; tick < BENCH_TICKS; tick++) {
+		for (int i = 0; i < BENCH_TICK_OBJECTS; i++) {
+			size_t size = 16 + (i * 37 + tick) % 240;
+			current[i] = malloc(size);
+			*(long*)current[i] = i;
+			if (tick) {
+				sum += *(long*)previous[i];
+				free(previous[i]);
+			}
+		}
+		memcpy(previous, current, sizeof(current));
+	}
+	for (int i = 0; i < BENCH_TICK_OBJECTS; i++) {
+		free(previous[i]);
+	}
+	printf("%24s %10.2f ms (sum %ld)\n", "malloc/free", (now_seconds() - start) * 1e3, sum);
+
+	for (int decommit = 0; decommit <= 1; decommit++) {
+		ArenaFrames* frames = ArenaFramesAlloc(2, 16384, decommit);
+		sum = 0;
+		start = now_seconds();
+		for (int tick = 0; tick < BENCH_TICKS; tick++) {
+			Arena* arena = ArenaFrameBegin(frames);
+			for (int i = 0; i < BENCH_TICK_OBJECTS; i++) {
+				size_t size = 16 + (i * 37 + tick) % 240;
+				current[i] = ArenaPush(arena, size);
+				*(long*)current[i] = i;
+				if (tick) {
+					sum += *(long*)previous[i];
+				}
+			}
+			//one spike tick that touches most of the arena
+			if (tick == BENCH_TICKS / 2) {
+				memset(ArenaPush(arena, 8192 * getpagesize()), 1, 8192 * getpagesize());
+			}
+			memcpy(previous, current, sizeof(current));
+		}
+		double elapsed = now_seconds() - start;
+		size_t resident = 0;
+		for (unsigned i = 0; i < frames->count; i++) {
+			Arena* arena = frames->arenas[i];
+			size_t pages = arena->size / getpagesize();
+			unsigned char* vec = (unsigned char*)malloc(pages);
+			mincore(arena, arena->size, vec);
+			for (size_t page = 0; page < pages; page++) {
+				resident += vec[page] & 1;
+			}
+			free(vec);
+		}
+		printf("%24s %10.2f ms (sum %ld) %8zu KiB resident\n", decommit ? "frames, decommit" : "frames",
+			elapsed * 1e3, sum, resident * getpagesize() / 1024);
+		ArenaFramesRelease(frames);
+	}
+}
+
+/* Readers looking up the current node of a pool while a writer keeps
+ * replacing it and recycling the old one, guarded by a rwlock against
+ * epoch based reclamation.
+ */
+typedef struct BenchEpochShared {
+	ArenaEpoch* domain;
+	pthread_rwlock_t lock;
+	bool use_epoch;
+	BenchElem* current;
+	int stop;
+	long reads;
+} BenchEpochShared;
+
+static void* bench_epoch_reader(void* arg) {
+	BenchEpochShared* shared = (BenchEpochShared*)arg;
+	ArenaEpochReader* reader = shared->use_epoch ? ArenaEpochJoin(shared->domain) : NULL;
+	long reads = 0;
+	volatile long sum = 0;
+	while (!__atomic_load_n(&shared->stop, __ATOMIC_RELAXED)) {
+		if (reader) {
+			ArenaEpochEnter(reader);
+		} else {
+			pthread_rwlock_rdlock(&shared->lock);
+		}
+		BenchElem* elem = __atomic_load_n(&shared->current, __ATOMIC_ACQUIRE);
+		sum += elem->key;
+		if (reader) {
+			ArenaEpochLeave(reader);
+		} else {
+			pthread_rwlock_unlock(&shared->lock);
+		}
+		reads++;
+	}
+	if (reader) {
+		ArenaEpochQuit(reader);
+	}
+	__atomic_add_fetch(&shared->reads, reads, __ATOMIC_RELAXED);
+	return NULL;
+}
+
+static void bench_ArenaEpoch(void) {
+	printf("bench_ArenaEpoch\n");
+	for (int use_epoch = 0; use_epoch <= 1; use_epoch++) {
+		//room for the elements retired while a reader is preempted inside an epoch
+		Arena* pool = ArenaAlloc(8192);
+		pool->one_type = true;
+		pool->elem_size = sizeof(BenchElem);
+		BenchEpochShared shared;
+		shared.domain = ArenaEpochAlloc(1024);
+		pthread_rwlock_init(&shared.lock, NULL);
+		shared.use_epoch = use_epoch;
+		shared.current = (BenchElem*)ArenaPush(pool, sizeof(BenchElem));
+		shared.stop = 0;
+		shared.reads = 0;
+		pthread_t readers[4];
+		for (int i = 0; i < 4; i++) {
+			pthread_create(&readers[i], NULL, bench_epoch_reader, &shared);
+		}
+		long writes = 0;
+		double start = now_seconds();
+		while (now_seconds() - start < 0.5) {
+			if (!use_epoch) {
+				pthread_rwlock_wrlock(&shared.lock);
+			}
+			BenchElem* elem = (BenchElem*)ArenaPush(pool, sizeof(BenchElem));
+			elem->key = writes;
+			BenchElem* old = __atomic_exchange_n(&shared.current, elem, __ATOMIC_ACQ_REL);
+			if (use_epoch) {
+				while (ArenaRetireDrop(shared.domain, pool, old) != 0) {
+					sched_yield();
+				}
+				if (writes % 64 == 0) {
+					ArenaEpochReclaim(shared.domain);
+				}
+			} else {
+				ArenaDrop(pool, old);
+				pthread_rwlock_unlock(&shared.lock);
+			}
+			writes++;
+		}
+		__atomic_store_n(&shared.stop, 1, __ATOMIC_RELAXED);
+		for (int i = 0; i < 4; i++) {
+			pthread_join(readers[i], NULL);
+		}
+		double elapsed = now_seconds() - start;
+		printf("%24s %10.2f Mreads/s %10.2f Mwrites/s\n", use_epoch ? "epoch" : "rwlock",
+			shared.reads / elapsed / 1e6, writes / elapsed / 1e6);
+		ArenaEpochRelease(shared.domain);
+		pthread_rwlock_destroy(&shared.lock);
+		ArenaRelease(pool);
+	}
+}
+
+/* One thread allocates elements and hands them to another that frees them,
+ * with a mutex around ArenaPush and ArenaDrop against an owned arena
+ * taking remote drops.
+ */
+#define BENCH_REMOTE_ELEMS (1 << 22)
+
+typedef struct BenchRemote {
+	Arena* arena;
+	ArenaRing* ring;
+	pthread_mutex_t* lock;
+} BenchRemote;
+
+static void* bench_remote_consumer(void* arg) {
+	BenchRemote* remote = (BenchRemote*)arg;
+	for (long i = 0; i < BENCH_REMOTE_ELEMS; i++) {
+		size_t available;
+		BenchElem** elem;
+		while (!(elem = (BenchElem**)ArenaRingPeek(remote->ring, &available))) {
+			sched_yield();
+		}
+		BenchElem* freed = *elem;
+		ArenaRingDrop(remote->ring, sizeof(BenchElem*));
+		if (remote->lock) {
+			pthread_mutex_lock(remote->lock);
+			ArenaDrop(remote->arena, freed);
+			pthread_mutex_unlock(remote->lock);
+		} else {
+			ArenaDrop(remote->arena, freed);
+		}
+	}
+	return NULL;
+}
+
+static void bench_ArenaDropRemote(void) {
+	printf("bench_ArenaDropRemote\n");
+	for (int owned = 0; owned <= 1; owned++) {
+		pthread_mutex_t lock;
+		pthread_mutex_init(&lock, NULL);
+		BenchRemote remote;
+		remote.arena = ArenaAlloc(4096);
+		remote.arena->one_type = true;
+		remote.arena->elem_size = sizeof(BenchElem);
+		remote.ring = ArenaRingAlloc(16);
+		remote.lock = owned ? NULL : &lock;
+		if (owned) {
+			ArenaSetOwner(remote.arena);
+		}
+		pthread_t consumer;
+		double start = now_seconds();
+		pthread_create(&consumer, NULL, bench_remote_consumer, &remote);
+		for (long i = 0; i < BENCH_REMOTE_ELEMS; i++) {
+			BenchElem* elem;
+			if (owned) {
+				elem = (BenchElem*)ArenaPush(remote.arena, sizeof(BenchElem));
+			} else {
+				pthread_mutex_lock(&lock);
+				elem = (BenchElem*)ArenaPush(remote.arena, sizeof(BenchElem));
+				pthread_mutex_unlock(&lock);
+			}
+			elem->key = i;
+			BenchElem** slot;
+			while (!(slot = (BenchElem**)ArenaRingPush(remote.ring, sizeof(BenchElem*)))) {
+				sched_yield();
+			}
+			*slot = elem;
+			ArenaRingCommit(remote.ring, sizeof(BenchElem*));
+		}
+		pthread_join(consumer, NULL);
+		double elapsed = now_seconds() - start;
+		printf("%24s %10.2f Mops/s, %zu KiB of the arena used\n", owned ? "owner + remote drops" : "mutex",
+			BENCH_REMOTE_ELEMS / elapsed / 1e6, (remote.arena->ptr - remote.arena->first_ptr) / 1024);
+		ArenaRingRelease(remote.ring);
+		ArenaRelease(remote.arena);
+		pthread_mutex_destroy(&lock);
+	}
+}
+
+/* Many more threads than cores pushing small elements, each to its own
+ * arena against per-CPU shards. Both are sized for the worst case, so the
+ * reserved memory is what each design has to set aside.
+ */
+#define BENCH_SHARD_PUSHES (1 << 20)
+
+typedef struct BenchShardWork {
+	ArenaShards* sharded;
+	Arena* own;
+} BenchShardWork;
+
+static void* bench_shard_thread(void* arg) {
+	BenchShardWork* work = (BenchShardWork*)arg;
+	for (long i = 0; i < BENCH_SHARD_PUSHES; i++) {
+		long* p = work->own ? (long*)ArenaPush(work->own, 32) : (long*)ArenaShardPush(work->sharded, 32);
+		p[0] = i;
+	}
+	return NULL;
+}
+
+static size_t bench_resident_kib(Arena* arena) {
+	size_t pages = arena->size / getpagesize();
+	unsigned char* vec = (unsigned char*)malloc(pages);
+	mincore(arena, arena->size, vec);
+	size_t resident = 0;
+	for (size_t page = 0; page < pages; page++) {
+		resident += vec[page] & 1;
+	}
+	free(vec);
+	return resident * getpagesize() / 1024;
+}
+
+static void bench_ArenaShards(void) {
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned threads = 4 * (cpus > 0 ? cpus : 1);
+	printf("bench_ArenaShards (%u threads on %ld cpus)\n", threads, cpus);
+	//enough for every thread to land on the same shard
+	unsigned pages = (unsigned)(((size_t)threads * BENCH_SHARD_PUSHES * 32) / getpagesize() + 2);
+	for (int sharded = 0; sharded <= 1; sharded++) {
+		BenchShardWork* work = (BenchShardWork*)calloc(threads, sizeof(BenchShardWork));
+		pthread_t* ids = (pthread_t*)calloc(threads, sizeof(pthread_t));
+		ArenaShards* shards = sharded ? ArenaShardsAlloc(pages) : NULL;
+		double start = now_seconds();
+		for (unsigned t = 0; t < threads; t++) {
+			work[t].sharded = shards;
+			//a per-thread arena has to be big enough for any one thread
+			work[t].own = sharded ? NULL : ArenaAlloc(BENCH_SHARD_PUSHES * 32 / getpagesize() + 2);
+			pthread_create(&ids[t], NULL, bench_shard_thread, &work[t]);
+		}
+		for (unsigned t = 0; t < threads; t++) {
+			pthread_join(ids[t], NULL);
+		}
+		double elapsed = now_seconds() - start;
+		size_t reserved = 0;
+		size_t resident = 0;
+		unsigned arenas = sharded ? shards->count : threads;
+		for (unsigned i = 0; i < arenas; i++) {
+			Arena* arena = sharded ? shards->shards[i].arena : work[i].own;
+			reserved += arena->size / 1024;
+			resident += bench_resident_kib(arena);
+			if (!sharded) {
+				ArenaRelease(arena);
+			}
+		}
+		printf("%24s %10.2f Mpush/s %4u arenas %10zu KiB reserved %10zu KiB resident\n",
+			sharded ? "per-cpu shards" : "per-thread arenas", (double)threads * BENCH_SHARD_PUSHES / elapsed / 1e6,
+			arenas, reserved, resident);
+		if (shards) {
+			ArenaShardsRelease(shards);
+		}
+		free(ids);
+		free(work);
+	}
+}
+
+/* Threads taking and giving back small batches of elements as fast as they
+ * can: a mutex around ArenaPush and ArenaDrop against the lock-free pool,
+ * with and without magazines.
+ */
+#define BENCH_POOL_ROUNDS (1 << 18)
+
+typedef struct BenchPoolWork {
+	int mode;
+	Arena* arena;
+	pthread_mutex_t* lock;
+	ArenaPool* pool;
+} BenchPoolWork;
+
+static void* bench_pool_thread(void* arg) {
+	BenchPoolWork* work = (BenchPoolWork*)arg;
+	ArenaMagazine magazine;
+	magazine.count = 0;
+	ArenaMagazine* mine = work->mode == 2 ? &magazine : NULL;
+	BenchElem* held[8];
+	for (long round = 0; round < BENCH_POOL_ROUNDS; round++) {
+		for (int i = 0; i < 8; i++) {
+			if (work->mode == 0) {
+				pthread_mutex_lock(work->lock);
+				held[i] = (BenchElem*)ArenaPush(work->arena, sizeof(BenchElem));
+				pthread_mutex_unlock(work->lock);
+			} else {
+				held[i] = (BenchElem*)ArenaPoolGet(work->pool, mine);
+			}
+			held[i]->key = round;
+		}
+		for (int i = 0; i < 8; i++) {
+			if (work->mode == 0) {
+				pthread_mutex_lock(work->lock);
+				ArenaDrop(work->arena, held[i]);
+				pthread_mutex_unlock(work->lock);
+			} else {
+				ArenaPoolPut(work->pool, mine, held[i]);
+			}
+		}
+	}
+	if (mine) {
+		ArenaMagazineFlush(work->pool, mine);
+	}
+	return NULL;
+}
+
+static void bench_ArenaPool(void) {
+	printf("bench_ArenaPool\n");
+	const char* names[] = {"mutex + ArenaPush/Drop", "pool", "pool + magazines"};
+	for (unsigned threads = 1; threads <= 8; threads *= 2) {
+		for (int mode = 0; mode < 3; mode++) {
+			pthread_mutex_t lock;
+			pthread_mutex_init(&lock, NULL);
+			Arena* arena = ArenaAlloc(1024);
+			arena->one_type = true;
+			arena->elem_size = sizeof(BenchElem);
+			ArenaPool* pool = ArenaPoolAlloc(sizeof(BenchElem), 1024);
+			BenchPoolWork work[8];
+			pthread_t ids[8];
+			double start = now_seconds();
+			for (unsigned t = 0; t < threads; t++) {
+				work[t].mode = mode;
+				work[t].arena = arena;
+				work[t].lock = &lock;
+				work[t].pool = pool;
+				pthread_create(&ids[t], NULL, bench_pool_thread, &work[t]);
+			}
+			for (unsigned t = 0; t < threads; t++) {
+				pthread_join(ids[t], NULL);
+			}
+			double elapsed = now_seconds() - start;
+			printf("%24s %u thr %10.2f Mops/s\n", names[mode], threads, threads * BENCH_POOL_ROUNDS * 16.0 / elapsed / 1e6);
+			ArenaPoolRelease(pool);
+			ArenaRelease(arena);
+			pthread_mutex_destroy(&lock);
+		}
+	}
+}
+
+/* Cost of a plain push and drop in an arena that has never used finalizers,
+ * one that has a finalizer registered below the pushes, and pushes that
+ * each register one.
+ */
+static void bench_cleanup_noop(void* obj) {
+	(void)obj;
+}
+
+static void bench_ArenaPushWithCleanup(void) {
+	printf("bench_ArenaPushWithCleanup\n");
+	const long rounds = 1 << 22;
+	const char* names[] = {"plain", "plain, finalizer below", "with finalizer"};
+	for (int mode = 0; mode < 3; mode++) {
+		Arena* arena = ArenaAlloc(16);
+		if (mode == 1) {
+			ArenaPushWithCleanup(arena, 64, bench_cleanup_noop);
+		}
+		void* mark = (void*)arena->ptr;
+		long sum = 0;
+		double start = now_seconds();
+		for (long i = 0; i < rounds; i++) {
+			long* p = mode == 2 ? (long*)ArenaPushWithCleanup(arena, 64, bench_cleanup_noop) : (long*)ArenaPush(arena, 64);
+			p[0] = i;
+			sum += p[0];
+			ArenaDropTo(arena, mark);
+		}
+		double elapsed = now_seconds() - start;
+		printf("%24s %8.2f ns/push+drop (sum %ld)\n", names[mode], elapsed / rounds * 1e9, sum);
+		ArenaRelease(arena);
+	}
+}
+
+/* Mixing 16 byte structs with 64 byte aligned buffers, one buffer every
+ * four structs: a 64 byte arena-wide alignment, toggling ArenaSetAlignment
+ * around every buffer, and ArenaPushAligned.
+ */
+static void bench_ArenaPushAligned(void) {
+	printf("bench_ArenaPushAligned\n");
+	const long count = 1 << 18;
+	const char* names[] = {"arena aligned to 64", "ArenaSetAlignment toggle", "ArenaPushAligned"};
+	for (int mode = 0; mode < 3; mode++) {
+		Arena* arena = ArenaAlloc(count * 64 / getpagesize() + 16);
+		if (mode == 0) {
+			ArenaSetAlignment(arena, 64);
+		}
+		long sum = 0;
+		double start = now_seconds();
+		for (long i = 0; i < count; i++) {
+			long* p;
+			if (i % 5 != 4) {
+				p = (long*)ArenaPush(arena, 16);
+			} else if (mode == 1) {
+				ArenaSetAlignment(arena, 64);
+				p = (long*)ArenaPush(arena, 64);
+				ArenaSetAlignment(arena, 8);
+			} else {
+				p = (long*)ArenaPushAligned(arena, 64, 64);
+			}
+			p[0] = i;
+			sum += p[0];
+		}
+		double elapsed = now_seconds() - start;
+		printf("%26s %8.2f ns/push %8zu KiB used (sum %ld)\n", names[mode], elapsed / count * 1e9,
+			(arena->ptr - arena->first_ptr) / 1024, sum);
+		ArenaRelease(arena);
+	}
+}
+
+/* Short lived scratch arenas of a few KiB, the way ArenaSwap and
+ * ArenaLiveBits use them: a fresh ArenaAlloc and ArenaRelease every time
+ * against a sub-arena carved from a parent, then ArenaSwap itself, which
+ * takes its scratch from the thread scratch arena.
+ */
+static void bench_ArenaAllocSub(void) {
+	printf("bench_ArenaAllocSub\n");
+	const long count = 1 << 16;
+	const char* names[] = {"ArenaAlloc", "ArenaAllocSub"};
+	Arena* parent = ArenaAlloc(64);
+	for (int mode = 0; mode < 2; mode++) {
+		long sum = 0;
+		double start = now_seconds();
+		for (long i = 0; i < count; i++) {
+			Arena* scratch = mode == 0 ? ArenaAlloc(2) : ArenaAllocSub(parent, 2 * 4096);
+			long* p = (long*)ArenaPush(scratch, 4096);
+			p[i % 512] = i;
+			sum += p[i % 512];
+			ArenaRelease(scratch);
+		}
+		double elapsed = now_seconds() - start;
+		printf("%26s %8.2f ns/scratch arena (sum %ld)\n", names[mode], elapsed / count * 1e9, sum);
+	}
+	ArenaRelease(parent);
+	Arena* arena = ArenaAlloc(4);
+	arena->one_type = true;
+	arena->elem_size = sizeof(BenchElem);
+	BenchElem* a = (BenchElem*)ArenaPush(arena, sizeof(BenchElem));
+	BenchElem* b = (BenchElem*)ArenaPush(arena, sizeof(BenchElem));
+	a->key = 1;
+	b->key = 2;
+	double start = now_seconds();
+	for (long i = 0; i < count; i++) {
+		ArenaSwap(arena, a, b);
+	}
+	double elapsed = now_seconds() - start;
+	printf("%26s %8.2f ns/swap (key %ld)\n", "ArenaSwap", elapsed / count * 1e9, a->key);
+	ArenaRelease(arena);
+}
+
+/* Cost of the registry: ArenaAlloc and ArenaRelease pairs now claim and
+ * clear a registry slot, and one ArenaReport over 200 arenas of 1 MiB with
+ * a quarter of their pages touched, written to /dev/null.
+ */
+static void bench_ArenaReport(void) {
+	printf("bench_ArenaReport\n");
+	const long count = 1 << 12;
+	double start = now_seconds();
+	for (long i = 0; i < count; i++) {
+		ArenaRelease(ArenaAlloc(4));
+	}
+	double elapsed = now_seconds() - start;
+	printf("%26s %8.2f us/pair\n", "ArenaAlloc + ArenaRelease", elapsed / count * 1e6);
+	Arena* arenas[200];
+	for (int i = 0; i < 200; i++) {
+		arenas[i] = ArenaAlloc(256);
+		memset(ArenaPush(arenas[i], 256 * 1024), 1, 256 * 1024);
+	}
+	int null_fd = open("/dev/null", O_WRONLY);
+	const int reports = 20;
+	start = now_seconds();
+	int listed = 0;
+	for (int i = 0; i < reports; i++) {
+		listed = ArenaReport(null_fd);
+	}
+	elapsed = now_seconds() - start;
+	printf("%26s %8.2f ms/report (%d arenas)\n", "ArenaReport", elapsed / reports * 1e3, listed);
+	close(null_fd);
+	for (int i = 0; i < 200; i++) {
+		ArenaRelease(arenas[i]);
+	}
+}
+
+/* 16 byte pushes with and without published stats, dropping back every
+ * 4096 pushes so the used and high water counters move both ways.
+ */
+static void bench_ArenaPublishStats(void) {
+	printf("bench_ArenaPublishStats\n");
+	const long count = 1 << 22;
+	const char* names[] = {"ArenaPush", "ArenaPush with stats"};
+	for (int mode = 0; mode < 2; mode++) {
+		Arena* arena = ArenaAlloc(32);
+		if (mode == 1) {
+			ArenaSetName(arena, "bench");
+			ArenaPublishStats(arena);
+		}
+		void* mark = (void*)arena->ptr;
+		long sum = 0;
+		double start = now_seconds();
+		for (long i = 0; i < count; i++) {
+			long* p = (long*)ArenaPush(arena, 16);
+			p[0] = i;
+			sum += p[0];
+			if (i % 4096 == 4095) {
+				ArenaDropTo(arena, mark);
+			}
+		}
+		double elapsed = now_seconds() - start;
+		printf("%26s %8.2f ns/push (sum %ld)\n", names[mode], elapsed / count * 1e9, sum);
+		ArenaRelease(arena);
+	}
+	ArenaUnlinkStats();
+}
+
+/* Main function to run all benchmarks */
+int main(void) {
+	bench_ArenaClone();
+	bench_ArenaForEach();
+	bench_ArenaReorder();
+	bench_ArenaDefragParallel();
+	bench_ArenaPrefault();
+	bench_ArenaRing();
+	bench_ArenaFrames();
+	bench_ArenaEpoch();
+	bench_ArenaDropRemote();
+	bench_ArenaShards();
+	bench_ArenaPool();
+	bench_ArenaPushWithCleanup();
+	bench_ArenaPushAligned();
+	bench_ArenaAllocSub();
+	bench_ArenaReport();
+	bench_ArenaPublishStats();
+	return 0;
+}
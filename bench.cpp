@@ -0,0 +1,166 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <cstdio>
+#include <ctime>
+#include <memory_resource>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "arena.hpp"
+
+
+/* -----------------------------------------------------------------------------
+ * Helpers
+ * -----------------------------------------------------------------------------*/
+
+static double now_seconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+struct BenchElem {
+	long key;
+	long payload[7];
+};
+
+struct BenchSmall {
+	int key;
+	short tag;
+};
+
+/* -----------------------------------------------------------------------------
+ * Benchmarks
+ * -----------------------------------------------------------------------------*/
+
+/* Filling a single type arena and emptying it again from the top, through
+ * the C API with its runtime element size and alignment against the
+ * template with both known at compile time.
+ */
+template <typename T>
+static void bench_typed_case(const char* name, size_t count, int rounds) {
+	long sum = 0;
+	::Arena* raw = ArenaAlloc(count * sizeof(T) / getpagesize() + 4);
+	raw->one_type = true;
+	raw->elem_size = sizeof(T);
+	double start = now_seconds();
+	for (int round = 0; round < rounds; round++) {
+		T* last = NULL;
+		for (size_t i = 0; i < count; i++) {
+			last = (T*)ArenaPush(raw, sizeof(T));
+			last->key = i;
+		}
+		sum += last->key;
+		for (size_t i = 0; i < count; i++) {
+			ArenaDrop(raw, last--);
+		}
+	}
+	double c_time = now_seconds() - start;
+	ArenaRelease(raw);
+
+	arena::Arena<T> typed(count * sizeof(T) / getpagesize() + 4);
+	start = now_seconds();
+	for (int round = 0; round < rounds; round++) {
+		T* last = NULL;
+		for (size_t i = 0; i < count; i++) {
+			last = typed.push();
+			last->key = i;
+		}
+		sum += last->key;
+		for (size_t i = 0; i < count; i++) {
+			typed.drop(last--);
+		}
+	}
+	double typed_time = now_seconds() - start;
+	double ops = 2.0 * count * rounds;
+	printf("%24s %8.2f ns/op C %8.2f ns/op template (sum %ld)\n", name, c_time / ops * 1e9, typed_time / ops * 1e9, sum);
+}
+
+static void bench_TypedArena(void) {
+	printf("bench_TypedArena\n");
+	bench_typed_case<BenchElem>("64 byte elements", 1 << 16, 200);
+	bench_typed_case<BenchSmall>("8 byte elements", 1 << 16, 200);
+}
+
+/* Building and throwing away a vector, a hash map of strings and a batch
+ * of strings, with the default allocator, a monotonic_buffer_resource and
+ * an ArenaResource. The monotonic resource and the arena are reset between
+ * rounds.
+ */
+static long bench_pmr_round(std::pmr::memory_resource* resource, int round) {
+	std::pmr::vector<long> numbers(resource);
+	for (long i = 0; i < 10000; i++) {
+		numbers.push_back(i + round);
+	}
+	std::pmr::unordered_map<int, std::pmr::string> names(resource);
+	for (int i = 0; i < 2000; i++) {
+		names.emplace(i, std::pmr::string("a name long enough to need its own buffer", resource));
+	}
+	std::pmr::vector<std::pmr::string> lines(resource);
+	for (int i = 0; i < 2000; i++) {
+		lines.emplace_back(40 + (i + round) % 8, 'x');
+	}
+	return numbers.back() + names.size() + lines.back().size();
+}
+
+static void bench_ArenaResource(void) {
+	printf("bench_ArenaResource\n");
+	const int rounds = 200;
+	long sum = 0;
+	double start = now_seconds();
+	for (int round = 0; round < rounds; round++) {
+		sum += bench_pmr_round(std::pmr::new_delete_resource(), round);
+	}
+	printf("%28s %8.2f ms (sum %ld)\n", "new_delete_resource", (now_seconds() - start) * 1e3, sum);
+
+	sum = 0;
+	std::pmr::monotonic_buffer_resource monotonic;
+	start = now_seconds();
+	for (int round = 0; round < rounds; round++) {
+		sum += bench_pmr_round(&monotonic, round);
+		monotonic.release();
+	}
+	printf("%28s %8.2f ms (sum %ld)\n", "monotonic_buffer_resource", (now_seconds() - start) * 1e3, sum);
+
+	sum = 0;
+	arena::ArenaRef ref(4096);
+	arena::ArenaResource resource(ref);
+	start = now_seconds();
+	for (int round = 0; round < rounds; round++) {
+		sum += bench_pmr_round(&resource, round);
+		ref.drop_to(reinterpret_cast<void*>(ref.get()->first_ptr));
+	}
+	printf("%28s %8.2f ms (sum %ld)\n", "ArenaResource", (now_seconds() - start) * 1e3, sum);
+
+	sum = 0;
+	start = now_seconds();
+	for (int round = 0; round < rounds; round++) {
+		std::vector<long> numbers;
+		for (long i = 0; i < 10000; i++) {
+			numbers.push_back(i + round);
+		}
+		sum += numbers.back();
+	}
+	printf("%28s %8.2f ms (sum %ld)\n", "vector, std::allocator", (now_seconds() - start) * 1e3, sum);
+
+	sum = 0;
+	start = now_seconds();
+	for (int round = 0; round < rounds; round++) {
+		std::vector<long, arena::ArenaAllocator<long>> numbers(arena::ArenaAllocator<long>(ref.get()));
+		for (long i = 0; i < 10000; i++) {
+			numbers.push_back(i + round);
+		}
+		sum += numbers.back();
+		numbers = std::vector<long, arena::ArenaAllocator<long>>(arena::ArenaAllocator<long>(ref.get()));
+		ref.drop_to(reinterpret_cast<void*>(ref.get()->first_ptr));
+	}
+	printf("%28s %8.2f ms (sum %ld)\n", "vector, ArenaAllocator", (now_seconds() - start) * 1e3, sum);
+}
+
+/* Main function to run all benchmarks */
+int main(void) {
+	bench_TypedArena();
+	bench_ArenaResource();
+	return 0;
+}
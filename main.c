@@ -1,5 +1,8 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <string.h>
+#include <sys/wait.h>
+#include <sched.h>
 #include "arena.c"
 
 
@@ -171,6 +174,1734 @@ void test_ArenaDefrag(void) {
 		ArenaRelease(arena);
 }
 
+/* Test ArenaAllocFile.
+ * We build a small linked list with offsets, sync and release the arena,
+ * then reopen the file at a different address and walk the list again.
+ */
+typedef struct FileNode {
+	long value;
+	ArenaOffset next;
+} FileNode;
+
+static void test_ArenaAllocFile(void) {
+	printf("Running test_ArenaAllocFile...\n");
+	const char* path = "/tmp/arena_test_file.bin";
+	unlink(path);
+	Arena* arena = ArenaAllocFile(path, 4);
+	assert(arena != NULL);
+	ArenaOffset head = 0;
+	for (long i = 1; i <= 10; i++) {
+		FileNode* node = (FileNode*)ArenaPush(arena, sizeof(FileNode));
+		assert(node != NULL);
+		node->value = i;
+		node->next = head;
+		head = ArenaOffsetOf(arena, node);
+	}
+	ArenaSetRoot(arena, ArenaOffsetPtr(arena, head));
+	size_t used = arena->ptr - arena->first_ptr;
+	void* old_base = arena;
+	assert(ArenaSync(arena) == 0);
+	assert(ArenaRelease(arena) == 0);
+
+	// Occupy the old address so the file has to be mapped somewhere else.
+	void* blocker = mmap(old_base, getpagesize(), PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+	assert(blocker == old_base);
+	arena = ArenaAllocFile(path, 0);
+	assert(arena != NULL);
+	assert((void*)arena != old_base);
+	assert(arena->ptr - arena->first_ptr == used);
+	long sum = 0;
+	for (FileNode* node = (FileNode*)ArenaGetRoot(arena); node; node = (FileNode*)ArenaOffsetPtr(arena, node->next)) {
+		sum += node->value;
+	}
+	assert(sum == 55);
+	// The reopened arena keeps working as a normal arena.
+	assert(ArenaPush(arena, sizeof(FileNode)) != NULL);
+	ArenaRelease(arena);
+	munmap(blocker, getpagesize());
+
+	// Files that aren't arenas are rejected.
+	int fd = open(path, O_RDWR | O_TRUNC);
+	assert(fd != -1);
+	char junk[8192] = {1};
+	assert(write(fd, junk, sizeof(junk)) == sizeof(junk));
+	close(fd);
+	assert(ArenaAllocFile(path, 0) == NULL);
+	unlink(path);
+}
+
+/* Test ArenaAllocAt, ArenaSave and ArenaLoad.
+ * A list linked with raw pointers is saved, reloaded at the same base and
+ * walked directly. Loading it again while the base is taken must fail, or
+ * relocate and report the distance when the caller asks for a fallback.
+ */
+typedef struct PtrNode {
+	long value;
+	struct PtrNode* next;
+} PtrNode;
+
+static void test_ArenaAllocAt_SaveLoad(void) {
+	printf("Running test_ArenaAllocAt_SaveLoad...\n");
+	const char* path = "/tmp/arena_test_image.bin";
+	// Find a free address range to use as the fixed base.
+	size_t span = 5 * getpagesize();
+	void* base = mmap(NULL, span, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	assert(base != MAP_FAILED);
+	// The range is taken, so a fixed arena can't go there.
+	assert(ArenaAllocAt(base, 4) == NULL);
+	munmap(base, span);
+
+	Arena* arena = ArenaAllocAt(base, 4);
+	assert(arena == base);
+	PtrNode* head = NULL;
+	for (long i = 1; i <= 10; i++) {
+		PtrNode* node = (PtrNode*)ArenaPush(arena, sizeof(PtrNode));
+		node->value = i;
+		node->next = head;
+		head = node;
+	}
+	ArenaSetRoot(arena, head);
+	assert(ArenaSave(arena, path) == 0);
+	ArenaRelease(arena);
+
+	arena = ArenaLoad(path, NULL);
+	assert(arena == base);
+	long sum = 0;
+	for (PtrNode* node = (PtrNode*)ArenaGetRoot(arena); node; node = node->next) {
+		sum += node->value;
+	}
+	assert(sum == 55);
+
+	// The base is still in use by the first load.
+	assert(ArenaLoad(path, NULL) == NULL);
+	ptrdiff_t delta = 0;
+	Arena* moved = ArenaLoad(path, &delta);
+	assert(moved != NULL && moved != arena);
+	assert((uintptr_t)moved - (uintptr_t)arena == (uintptr_t)delta);
+	sum = 0;
+	for (PtrNode* node = (PtrNode*)ArenaGetRoot(moved); node; node = node->next) {
+		// Patch the raw pointers as we go.
+		if (node->next) {
+			node->next = (PtrNode*)((uintptr_t)node->next + delta);
+		}
+		assert((uintptr_t)node > (uintptr_t)moved && (uintptr_t)node < moved->end_ptr);
+		sum += node->value;
+	}
+	assert(sum == 55);
+	ArenaRelease(moved);
+	ArenaRelease(arena);
+	unlink(path);
+}
+
+/* Test ArenaClone and ArenaSnapshot.
+ * Clones and snapshots must not see writes made after they were taken,
+ * and the source must not see writes made to a clone.
+ */
+static void test_ArenaClone(void) {
+	printf("Running test_ArenaClone...\n");
+	Arena* arena = ArenaAllocMemfd(4);
+	assert(arena != NULL);
+	arena->one_type = true;
+	arena->elem_size = sizeof(long);
+	ArenaSetAlignment(arena, sizeof(long));
+	long* values[16];
+	for (int i = 0; i < 16; i++) {
+		values[i] = (long*)ArenaPush(arena, arena->elem_size);
+		*values[i] = i;
+	}
+	// Leave a hole so the clone needs its own free list.
+	ArenaPop(arena, values[3]);
+
+	Arena* clone = ArenaClone(arena);
+	assert(clone != NULL);
+	assert(clone->ptr - clone->first_ptr == arena->ptr - arena->first_ptr);
+	long* cloned = (long*)clone->first_ptr;
+	assert(cloned[5] == 5);
+	*values[5] = 500;
+	cloned[6] = 600;
+	assert(cloned[5] == 5);
+	assert(*values[6] == 6);
+	// The clone fills its own copy of the hole.
+	long* refill = (long*)ArenaPush(clone, clone->elem_size);
+	assert(refill == &cloned[3]);
+	*refill = 300;
+	assert(*values[3] == 0);
+
+	// A second fork of the source has to copy it into a new memfd.
+	Arena* snap = ArenaSnapshot(arena);
+	assert(snap != NULL);
+	long* snapped = (long*)snap->first_ptr;
+	assert(snapped[5] == 500);
+	*values[5] = 5000;
+	assert(snapped[5] == 500);
+	assert(cloned[5] == 5);
+	long* pushed = (long*)ArenaPush(arena, arena->elem_size);
+	assert(pushed == values[3]);
+
+	// Every arena keeps a memfd of its own, also after the source moved to a new one twice.
+	Arena* again = ArenaClone(arena);
+	assert(again != NULL);
+	int fds[4] = {arena->fd, clone->fd, snap->fd, again->fd};
+	for (int i = 0; i < 4; i++) {
+		assert(fds[i] >= 0 && fcntl(fds[i], F_GETFD) != -1);
+		for (int j = 0; j < i; j++) {
+			assert(fds[i] != fds[j]);
+		}
+	}
+	ArenaRelease(again);
+	assert(fcntl(arena->fd, F_GETFD) != -1 && fcntl(clone->fd, F_GETFD) != -1);
+
+	// An image of a memfd arena reloads as a plain arena.
+	const char* path = "/tmp/arena_test_clone_image.bin";
+	assert(ArenaSave(arena, path) == 0);
+	ptrdiff_t delta = 0;
+	Arena* loaded = ArenaLoad(path, &delta);
+	assert(loaded != NULL && loaded->fd == -1 && !loaded->cow);
+	ArenaRelease(loaded);
+	unlink(path);
+	assert(fcntl(arena->fd, F_GETFD) != -1);
+
+	ArenaRelease(snap);
+	ArenaRelease(clone);
+	assert(*values[6] == 6);
+	ArenaRelease(arena);
+}
+
+/* Test ArenaTrackDirty, ArenaCheckpoint and ArenaApplyCheckpoint.
+ * The first checkpoint is a full image. After changing a single long, the
+ * next checkpoint must hold only that page, and applying both to an empty
+ * image must reproduce the arena.
+ */
+static void test_ArenaCheckpoint(void) {
+	printf("Running test_ArenaCheckpoint...\n");
+	const char* delta_path = "/tmp/arena_test_delta.bin";
+	const char* image_path = "/tmp/arena_test_delta_image.bin";
+	long page_size = getpagesize();
+	Arena* arena = ArenaAlloc(16);
+	size_t count = 4 * page_size / sizeof(long);
+	long* values = (long*)ArenaPush(arena, count * sizeof(long));
+	for (size_t i = 0; i < count; i++) {
+		values[i] = i;
+	}
+	int mode = ArenaTrackDirty(arena);
+	assert(mode == ARENA_DIRTY_SOFT || mode == ARENA_DIRTY_MPROTECT);
+	size_t used_pages = (arena->ptr - (uintptr_t)arena + page_size - 1) / page_size;
+
+	int image = open(image_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	int delta = open(delta_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	assert(image != -1 && delta != -1);
+	assert(ArenaCheckpoint(arena, delta) == (long)used_pages);
+	lseek(delta, 0, SEEK_SET);
+	assert(ArenaApplyCheckpoint(delta, image) == (long)used_pages);
+
+	// Nothing changed, so the next checkpoint is empty.
+	assert(ftruncate(delta, 0) == 0);
+	lseek(delta, 0, SEEK_SET);
+	assert(ArenaCheckpoint(arena, delta) == 0);
+
+	values[2 * page_size / sizeof(long)] = -1;
+	assert(ftruncate(delta, 0) == 0);
+	lseek(delta, 0, SEEK_SET);
+	assert(ArenaCheckpoint(arena, delta) == 1);
+	lseek(delta, 0, SEEK_SET);
+	assert(ArenaApplyCheckpoint(delta, image) == 1);
+
+	// Compare everything after the header, which holds pointers that differ between the two.
+	size_t bytes = arena->ptr - (uintptr_t)arena - sizeof(Arena);
+	Arena* copy = ArenaAlloc(16);
+	void* data = ArenaPush(copy, bytes);
+	assert(pread(image, data, bytes, sizeof(Arena)) == (ssize_t)bytes);
+	assert(memcmp(data, (void*)((uintptr_t)arena + sizeof(Arena)), bytes) == 0);
+	close(image);
+	close(delta);
+	ArenaRelease(copy);
+	ArenaRelease(arena);
+	unlink(delta_path);
+	unlink(image_path);
+}
+
+/* Test shared memory arenas.
+ * A forked child attaches through the inherited memfd, allocates and fills
+ * buffers and passes only their offsets back through a pipe. Both processes
+ * allocate at the same time, so no two offsets may overlap.
+ */
+static void test_ArenaShared(void) {
+	printf("Running test_ArenaShared...\n");
+	int fd;
+	Arena* arena = ArenaAllocShared(NULL, 16, &fd);
+	assert(arena != NULL);
+	int pipefd[2];
+	assert(pipe(pipefd) == 0);
+	enum { BUFFERS = 64, BUFFER_SIZE = 100 };
+	pid_t pid = fork();
+	assert(pid != -1);
+	if (pid == 0) {
+		Arena* child = ArenaAttachSharedFd(fd);
+		if (!child || (void*)child == (void*)arena) {
+			_exit(1);
+		}
+		for (int i = 0; i < BUFFERS; i++) {
+			ArenaOffset offset = ArenaPushShared(child, BUFFER_SIZE);
+			memset(ArenaOffsetPtr(child, offset), 'a' + i % 26, BUFFER_SIZE);
+			if (write(pipefd[1], &offset, sizeof(offset)) != sizeof(offset)) {
+				_exit(1);
+			}
+		}
+		ArenaRelease(child);
+		_exit(0);
+	}
+	close(pipefd[1]);
+	ArenaOffset mine[BUFFERS];
+	for (int i = 0; i < BUFFERS; i++) {
+		mine[i] = ArenaPushShared(arena, BUFFER_SIZE);
+		assert(mine[i] != 0);
+		memset(ArenaOffsetPtr(arena, mine[i]), 'X', BUFFER_SIZE);
+	}
+	for (int i = 0; i < BUFFERS; i++) {
+		ArenaOffset offset;
+		assert(read(pipefd[0], &offset, sizeof(offset)) == sizeof(offset));
+		assert(offset % arena->alignment == 0);
+		char* buffer = (char*)ArenaOffsetPtr(arena, offset);
+		for (int j = 0; j < BUFFER_SIZE; j++) {
+			assert(buffer[j] == 'a' + i % 26);
+		}
+	}
+	int status;
+	assert(waitpid(pid, &status, 0) == pid);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	for (int i = 0; i < BUFFERS; i++) {
+		char* buffer = (char*)ArenaOffsetPtr(arena, mine[i]);
+		for (int j = 0; j < BUFFER_SIZE; j++) {
+			assert(buffer[j] == 'X');
+		}
+	}
+	close(pipefd[0]);
+	close(fd);
+	// Running out of room fails instead of overlapping.
+	assert(ArenaPushShared(arena, arena->size) == 0);
+	ArenaRelease(arena);
+
+	// Named arenas can be attached by name.
+	const char* name = "/arena_test_shared";
+	shm_unlink(name);
+	arena = ArenaAllocShared(name, 4, NULL);
+	assert(arena != NULL);
+	Arena* other = ArenaAttachShared(name);
+	assert(other != NULL && other != arena);
+	ArenaOffset offset = ArenaPushShared(other, sizeof(long));
+	*(long*)ArenaOffsetPtr(other, offset) = 1234;
+	assert(*(long*)ArenaOffsetPtr(arena, offset) == 1234);
+	assert(ArenaPushShared(arena, sizeof(long)) != offset);
+	assert(ArenaUnlinkShared(name) == 0);
+	ArenaRelease(other);
+	ArenaRelease(arena);
+}
+
+/* Test hole reuse with and without an occupancy bitmap.
+ * Without the bitmap holes are reused last dropped first. With it the
+ * lowest hole is reused first, dropping the top trims the holes under it,
+ * and ArenaDefrag moves the top elements into the lowest holes.
+ */
+static void test_ArenaTrackOccupancy(void) {
+	printf("Running test_ArenaTrackOccupancy...\n");
+	Arena* arena = ArenaAlloc(64);
+	arena->one_type = true;
+	arena->elem_size = sizeof(long);
+	ArenaSetAlignment(arena, sizeof(long));
+	long* p[8];
+	for (int i = 0; i < 8; i++) {
+		p[i] = (long*)ArenaPush(arena, arena->elem_size);
+		*p[i] = i;
+	}
+	ArenaPop(arena, p[1]);
+	ArenaPop(arena, p[3]);
+	assert(ArenaLiveCount(arena) == 6);
+	assert(ArenaPush(arena, arena->elem_size) == p[3]);
+	assert(ArenaPush(arena, arena->elem_size) == p[1]);
+	assert(arena->to_free == NULL);
+	assert((long*)ArenaPush(arena, arena->elem_size) == p[7] + 1);
+	ArenaDropTo(arena, p[7] + 1);
+
+	ArenaPop(arena, p[5]);
+	ArenaPop(arena, p[1]);
+	assert(ArenaTrackOccupancy(arena) == 0);
+	assert(arena->free_list == NULL);
+	assert(arena->holes == 2);
+	assert(ArenaLiveCount(arena) == 6);
+	assert(!ArenaIsLive(arena, p[1]) && ArenaIsLive(arena, p[2]) && !ArenaIsLive(arena, p[5]));
+	ArenaPop(arena, p[3]);
+	assert(ArenaPush(arena, arena->elem_size) == p[1]);
+	assert(ArenaPush(arena, arena->elem_size) == p[3]);
+	assert(ArenaPush(arena, arena->elem_size) == p[5]);
+	assert(arena->holes == 0);
+	for (int i = 0; i < 8; i++) {
+		*p[i] = i;
+	}
+
+	// Dropping the top trims the hole below it.
+	ArenaPop(arena, p[6]);
+	ArenaPop(arena, p[7]);
+	assert(arena->ptr == (uintptr_t)p[6]);
+	assert(arena->holes == 0);
+
+	ArenaPop(arena, p[2]);
+	ArenaPop(arena, p[4]);
+	ArenaDefrag(arena);
+	assert(arena->holes == 0);
+	assert(ArenaLiveCount(arena) == 4);
+	assert(arena->ptr == (uintptr_t)p[4]);
+	assert(*p[0] == 0 && *p[1] == 1 && *p[2] == 5 && *p[3] == 3);
+
+	// Fill far enough that the word scan has to skip full words.
+	ArenaDropTo(arena, p[0]);
+	assert(ArenaLiveCount(arena) == 0);
+	long* first = (long*)ArenaPush(arena, arena->elem_size);
+	for (int i = 1; i < 1000; i++) {
+		ArenaPush(arena, arena->elem_size);
+	}
+	ArenaDrop(arena, first + 900);
+	ArenaDrop(arena, first + 950);
+	assert(ArenaLiveCount(arena) == 998);
+	assert(ArenaPush(arena, arena->elem_size) == first + 900);
+	assert(ArenaPush(arena, arena->elem_size) == first + 950);
+	assert(ArenaPush(arena, arena->elem_size) == first + 1000);
+	ArenaDropTo(arena, first + 10);
+	assert(ArenaLiveCount(arena) == 10);
+	ArenaRelease(arena);
+}
+
+/* Test ArenaForEach, ArenaForEachRun and ArenaForEachParallel.
+ * Every live element must be visited exactly once and no hole may be
+ * visited, with and without an occupancy bitmap.
+ */
+static void sum_visit(void* elem, void* ctx) {
+	__atomic_fetch_add((long*)ctx, *(long*)elem, __ATOMIC_RELAXED);
+}
+
+static void count_runs(void* first, size_t count, void* ctx) {
+	long* runs = (long*)ctx;
+	runs[0]++;
+	for (size_t i = 0; i < count; i++) {
+		assert(((long*)first)[i] != 0);
+		runs[1] += ((long*)first)[i];
+	}
+}
+
+static void test_ArenaForEach(void) {
+	printf("Running test_ArenaForEach...\n");
+	for (int bitmap = 0; bitmap < 2; bitmap++) {
+		Arena* arena = ArenaAlloc(16);
+		arena->one_type = true;
+		arena->elem_size = sizeof(long);
+		ArenaSetAlignment(arena, sizeof(long));
+		long* first = NULL;
+		long expected = 0;
+		for (long i = 1; i <= 1000; i++) {
+			long* value = (long*)ArenaPush(arena, arena->elem_size);
+			*value = i;
+			expected += i;
+			if (!first) {
+				first = value;
+			}
+		}
+		if (bitmap) {
+			ArenaTrackOccupancy(arena);
+		}
+		// Holes at both ends of a word, across a word boundary and alone.
+		long dropped[] = {0, 63, 64, 65, 127, 500, 998};
+		for (size_t i = 0; i < sizeof(dropped) / sizeof(dropped[0]); i++) {
+			expected -= first[dropped[i]];
+			ArenaPop(arena, &first[dropped[i]]);
+		}
+		long sum = 0;
+		ArenaForEach(arena, sum_visit, &sum);
+		assert(sum == expected);
+		long runs[2] = {0, 0};
+		ArenaForEachRun(arena, count_runs, runs);
+		assert(runs[0] == 5);
+		assert(runs[1] == expected);
+		for (unsigned threads = 1; threads <= 4; threads++) {
+			sum = 0;
+			ArenaForEachParallel(arena, sum_visit, &sum, threads);
+			assert(sum == expected);
+		}
+		ArenaRelease(arena);
+	}
+}
+
+/* Test generational handles.
+ * Handles must follow their elements through ArenaSwap and ArenaDefrag,
+ * and stop resolving once the element is dropped in any way.
+ */
+static void test_ArenaHandles(void) {
+	printf("Running test_ArenaHandles...\n");
+	Arena* arena = ArenaAlloc(4);
+	arena->one_type = true;
+	arena->elem_size = sizeof(long);
+	ArenaSetAlignment(arena, sizeof(long));
+	assert(ArenaTrackHandles(arena) == 0);
+	assert(arena->occupancy != NULL);
+	ArenaHandle handles[10];
+	for (long i = 0; i < 10; i++) {
+		long* value = (long*)ArenaPushHandle(arena, &handles[i]);
+		*value = i;
+		assert(ArenaHandlePtr(arena, handles[i]) == value);
+	}
+	ArenaHandle zero = {0, 0};
+	assert(ArenaHandlePtr(arena, zero) == NULL);
+
+	assert(ArenaDropHandle(arena, handles[2]) == 0);
+	assert(ArenaHandlePtr(arena, handles[2]) == NULL);
+	assert(ArenaDropHandle(arena, handles[2]) == -1);
+	// Dropping by pointer makes the handle stale too.
+	ArenaPop(arena, ArenaHandlePtr(arena, handles[5]));
+	assert(ArenaHandlePtr(arena, handles[5]) == NULL);
+
+	ArenaDefrag(arena);
+	assert(ArenaLiveCount(arena) == 8);
+	for (long i = 0; i < 10; i++) {
+		long* value = (long*)ArenaHandlePtr(arena, handles[i]);
+		if (i == 2 || i == 5) {
+			assert(value == NULL);
+		} else {
+			assert(value != NULL && *value == i);
+		}
+	}
+	// The elements from the top were moved into the holes.
+	assert(ArenaHandlePtr(arena, handles[9]) == (void*)(arena->first_ptr + 2 * sizeof(long)));
+
+	long* a = (long*)ArenaHandlePtr(arena, handles[0]);
+	long* b = (long*)ArenaHandlePtr(arena, handles[1]);
+	ArenaSwap(arena, a, b);
+	assert(ArenaHandlePtr(arena, handles[0]) == b && *b == 0);
+	assert(ArenaHandlePtr(arena, handles[1]) == a && *a == 1);
+
+	// Entries are reused with a new generation.
+	ArenaHandle reused;
+	ArenaPushHandle(arena, &reused);
+	assert(reused.index == handles[5].index || reused.index == handles[2].index);
+	assert(ArenaHandlePtr(arena, handles[5]) == NULL && ArenaHandlePtr(arena, handles[2]) == NULL);
+	assert(ArenaHandlePtr(arena, reused) != NULL);
+
+	ArenaDropTo(arena, (void*)arena->first_ptr);
+	assert(ArenaHandlePtr(arena, handles[0]) == NULL);
+	assert(ArenaHandlePtr(arena, reused) == NULL);
+	ArenaRelease(arena);
+}
+
+/* Test ArenaReorder and ArenaReorderBy.
+ * Elements must end up in the requested order with the holes squeezed
+ * out, every move must be reported, and handles must follow.
+ */
+typedef struct MoveLog {
+	long moves;
+	long* first;
+	long new_slot_of_value[16];
+} MoveLog;
+
+static void log_move(void* from, void* to, void* ctx) {
+	(void)from;
+	MoveLog* log = (MoveLog*)ctx;
+	log->moves++;
+	long value = *(long*)to;
+	log->new_slot_of_value[value] = (long*)to - log->first;
+}
+
+static uint64_t descending_key(const void* elem, void* ctx) {
+	(void)ctx;
+	return 100 - *(const long*)elem;
+}
+
+static void test_ArenaReorder(void) {
+	printf("Running test_ArenaReorder...\n");
+	for (int bitmap = 0; bitmap < 2; bitmap++) {
+		Arena* arena = ArenaAlloc(4);
+		arena->one_type = true;
+		arena->elem_size = sizeof(long);
+		ArenaSetAlignment(arena, sizeof(long));
+		ArenaHandle handles[10];
+		long* first = NULL;
+		if (bitmap) {
+			ArenaTrackHandles(arena);
+		}
+		for (long i = 0; i < 10; i++) {
+			long* value = bitmap ? (long*)ArenaPushHandle(arena, &handles[i]) : (long*)ArenaPush(arena, arena->elem_size);
+			*value = i;
+			if (!first) {
+				first = value;
+			}
+		}
+		ArenaPop(arena, &first[3]);
+		ArenaPop(arena, &first[6]);
+
+		// Reverse the live elements: 9 8 7 5 4 2 1 0.
+		size_t order[] = {9, 8, 7, 5, 4, 2, 1, 0};
+		size_t bad[] = {9, 8, 7, 5, 4, 2, 1, 3};
+		assert(ArenaReorder(arena, bad, NULL, NULL) == -1);
+		MoveLog log = {0, first, {0}};
+		assert(ArenaReorder(arena, order, log_move, &log) == 0);
+		for (int i = 0; i < 8; i++) {
+			assert(first[i] == (long)order[i]);
+		}
+		assert(arena->ptr == (uintptr_t)&first[8]);
+		assert(ArenaLiveCount(arena) == 8);
+		// Value 4 is already in slot 4, everything else moves.
+		assert(log.moves == 7);
+		assert(log.new_slot_of_value[9] == 0 && log.new_slot_of_value[0] == 7);
+		if (bitmap) {
+			for (long i = 0; i < 10; i++) {
+				long* value = (long*)ArenaHandlePtr(arena, handles[i]);
+				assert(i == 3 || i == 6 ? value == NULL : *value == i);
+			}
+			assert(arena->holes == 0);
+		}
+
+		assert(ArenaReorderBy(arena, descending_key, NULL, NULL) == 0);
+		for (int i = 0; i < 8; i++) {
+			assert(first[i] == (long)order[i]);
+		}
+		ArenaRelease(arena);
+	}
+}
+
+/* Test ArenaDefragParallel.
+ * For any number of threads, compacting in parallel must leave every
+ * element exactly where the sequential ArenaDefrag puts it.
+ */
+static Arena* make_holey_arena(bool bitmap) {
+	Arena* arena = ArenaAlloc(64);
+	arena->one_type = true;
+	arena->elem_size = sizeof(long);
+	ArenaSetAlignment(arena, sizeof(long));
+	if (bitmap) {
+		ArenaTrackOccupancy(arena);
+	}
+	long* first = (long*)ArenaPush(arena, arena->elem_size);
+	for (long i = 1; i < 5000; i++) {
+		ArenaPush(arena, arena->elem_size);
+	}
+	for (long i = 0; i < 5000; i++) {
+		first[i] = i + 1;
+	}
+	uint64_t seed = 1;
+	for (int i = 0; i < 2000; i++) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		long index = (seed >> 33) % 5000;
+		if (first[index] != 0 && (uintptr_t)&first[index] < arena->ptr) {
+			ArenaPop(arena, &first[index]);
+		}
+	}
+	return arena;
+}
+
+static void test_ArenaDefragParallel(void) {
+	printf("Running test_ArenaDefragParallel...\n");
+	Arena* expected = make_holey_arena(true);
+	ArenaDefrag(expected);
+	size_t used = expected->ptr - expected->first_ptr;
+	for (unsigned threads = 1; threads <= 5; threads++) {
+		for (int bitmap = 0; bitmap < 2; bitmap++) {
+			Arena* arena = make_holey_arena(bitmap);
+			ArenaDefragParallel(arena, threads);
+			assert(arena->ptr - arena->first_ptr == used);
+			assert(memcmp((void*)arena->first_ptr, (void*)expected->first_ptr, used) == 0);
+			assert(ArenaLiveCount(arena) == used / sizeof(long));
+			if (bitmap) {
+				assert(arena->holes == 0);
+				// The bitmap is still usable afterwards.
+				ArenaPop(arena, (void*)arena->first_ptr);
+				assert(ArenaPush(arena, arena->elem_size) == (void*)arena->first_ptr);
+			}
+			ArenaRelease(arena);
+		}
+	}
+	ArenaRelease(expected);
+}
+
+/* Test ArenaAllocEx and ArenaSetTouchAhead.
+ * Populated arenas must be resident before anything is pushed, and
+ * touch-ahead must keep the pages past ptr resident as the arena grows.
+ */
+static size_t resident_pages(void* from, size_t bytes) {
+	long page_size = getpagesize();
+	size_t pages = (bytes + page_size - 1) / page_size;
+	unsigned char vec[256];
+	assert(pages <= sizeof(vec));
+	assert(mincore(from, bytes, vec) == 0);
+	size_t resident = 0;
+	for (size_t i = 0; i < pages; i++) {
+		resident += vec[i] & 1;
+	}
+	return resident;
+}
+
+static void test_ArenaPrefault(void) {
+	printf("Running test_ArenaPrefault...\n");
+	long page_size = getpagesize();
+	Arena* arena = ArenaAllocEx(64, ARENA_POPULATE);
+	assert(arena != NULL);
+	assert(resident_pages(arena, arena->size) == 64);
+	ArenaRelease(arena);
+
+	arena = ArenaAllocEx(64, ARENA_LOCK);
+	if (arena) {
+		assert(resident_pages(arena, arena->size) == 64);
+		ArenaRelease(arena);
+	}
+
+	arena = ArenaAlloc(128);
+	ArenaSetTouchAhead(arena, 8);
+	// The helper thread faults the window in, wait for it before looking.
+	ArenaTouchWait(arena);
+	assert(resident_pages(arena, 9 * page_size) == 9);
+	assert(resident_pages((void*)((uintptr_t)arena + 16 * page_size), 16 * page_size) == 0);
+	for (int i = 0; i < 40; i++) {
+		ArenaPush(arena, page_size);
+	}
+	// Everything up to ptr plus at least half the window is faulted in.
+	ArenaTouchWait(arena);
+	uintptr_t ahead = arena->ptr + 4 * page_size;
+	assert(resident_pages(arena, ahead - (uintptr_t)arena) == (ahead - (uintptr_t)arena + page_size - 1) / page_size);
+	assert(resident_pages((void*)((uintptr_t)arena + 64 * page_size), 32 * page_size) == 0);
+	ArenaSetTouchAhead(arena, 0);
+	assert(arena->touch_at == arena->end_ptr);
+	ArenaRelease(arena);
+}
+
+/* Test ArenaPushHigh and ArenaDropToHigh.
+ * Scratch grows down from the end of the arena, both ends refuse to run
+ * into each other, and dropping the top end leaves the bottom alone.
+ */
+static void test_ArenaPushHigh(void) {
+	printf("Running test_ArenaPushHigh...\n");
+	Arena* arena = ArenaAlloc(1);
+	long* low = (long*)ArenaPush(arena, 8 * sizeof(long));
+	for (int i = 0; i < 8; i++) {
+		low[i] = i;
+	}
+	void* mark = (void*)arena->high_ptr;
+	assert(mark == (void*)arena->end_ptr);
+	char* scratch = (char*)ArenaPushHigh(arena, 100);
+	assert(scratch != NULL);
+	assert((uintptr_t)scratch % arena->alignment == 0);
+	assert((uintptr_t)scratch + 100 <= arena->end_ptr);
+	memset(scratch, 0xab, 100);
+	char* more = (char*)ArenaPushHigh(arena, 50);
+	assert(more + 50 <= scratch);
+
+	// Neither end can run into the other.
+	size_t gap = arena->high_ptr - arena->ptr;
+	assert(ArenaPushHigh(arena, gap + 1) == NULL);
+	assert(ArenaPush(arena, gap) == NULL);
+	void* top = ArenaPushHigh(arena, gap / 2);
+	assert(top != NULL && (uintptr_t)top >= arena->ptr);
+	assert(ArenaPush(arena, gap) == NULL);
+	// ArenaDropTo can't move ptr into the top end.
+	uintptr_t ptr = arena->ptr;
+	ArenaDropTo(arena, scratch);
+	assert(arena->ptr == ptr);
+
+	ArenaDropToHigh(arena, more);
+	assert(arena->high_ptr == (uintptr_t)more);
+	ArenaDropToHigh(arena, mark);
+	assert(arena->high_ptr == arena->end_ptr);
+	for (int i = 0; i < 8; i++) {
+		assert(low[i] == i);
+	}
+	// The whole arena is available to ArenaPush again.
+	assert(ArenaPush(arena, gap) != NULL);
+	ArenaRelease(arena);
+
+	// Clones of an arena that has been forked before keep the top end.
+	arena = ArenaAllocMemfd(4);
+	ArenaPush(arena, 64);
+	char* kept = (char*)ArenaPushHigh(arena, 64);
+	strcpy(kept, "top end");
+	Arena* first = ArenaClone(arena);
+	Arena* second = ArenaClone(arena);
+	assert(second->high_ptr - (uintptr_t)second == arena->high_ptr - (uintptr_t)arena);
+	assert(strcmp((char*)second->high_ptr, "top end") == 0);
+	ArenaRelease(second);
+	ArenaRelease(first);
+	ArenaRelease(arena);
+}
+
+/* Test the ring arena.
+ * Pushes that wrap past the end of the ring must stay contiguous, the
+ * ring must refuse to overfill, read/write must go through the ring, and
+ * a producer and a consumer thread must see every byte in order.
+ */
+#define RING_MESSAGES 100000
+
+static void* ring_producer(void* arg) {
+	ArenaRing* ring = (ArenaRing*)arg;
+	for (uint64_t i = 0; i < RING_MESSAGES; i++) {
+		size_t size = sizeof(uint64_t) * (1 + i % 5);
+		uint64_t* msg;
+		while (!(msg = (uint64_t*)ArenaRingPush(ring, size))) {
+			sched_yield();
+		}
+		for (size_t j = 0; j < size / sizeof(uint64_t); j++) {
+			msg[j] = i;
+		}
+		ArenaRingCommit(ring, size);
+	}
+	return NULL;
+}
+
+static void test_ArenaRing(void) {
+	printf("Running test_ArenaRing...\n");
+	long page_size = getpagesize();
+	ArenaRing* ring = ArenaRingAlloc(1);
+	assert(ring != NULL);
+	assert(ring->size == (size_t)page_size);
+
+	// Move head and tail close to the end so the next push wraps.
+	size_t available;
+	ArenaRingPush(ring, page_size - 16);
+	ArenaRingCommit(ring, page_size - 16);
+	assert(ArenaRingPush(ring, 17) == NULL);
+	assert(ArenaRingPeek(ring, &available) == ring->data && available == (size_t)page_size - 16);
+	ArenaRingDrop(ring, page_size - 16);
+	assert(ArenaRingPeek(ring, &available) == NULL && available == 0);
+
+	char* wrapped = (char*)ArenaRingPush(ring, 64);
+	assert(wrapped == ring->data + page_size - 16);
+	for (int i = 0; i < 64; i++) {
+		wrapped[i] = (char)i;
+	}
+	ArenaRingCommit(ring, 64);
+	// The bytes past the end of the ring landed at its start.
+	assert(ring->data[0] == 16 && ring->data[47] == 63);
+	char* read = (char*)ArenaRingPeek(ring, &available);
+	assert(read == wrapped && available == 64);
+	for (int i = 0; i < 64; i++) {
+		assert(read[i] == (char)i);
+	}
+	ArenaRingDrop(ring, 64);
+
+	// read and write go straight between the ring and the descriptors.
+	int in[2];
+	int out[2];
+	assert(pipe(in) == 0 && pipe(out) == 0);
+	const char message[] = "streamed through the ring";
+	assert(write(in[1], message, sizeof(message)) == (ssize_t)sizeof(message));
+	assert(ArenaRingReadFrom(ring, in[0], page_size) == (ssize_t)sizeof(message));
+	assert(ArenaRingPeek(ring, &available) != NULL && available == sizeof(message));
+	assert(ArenaRingWriteTo(ring, out[1], page_size) == (ssize_t)sizeof(message));
+	assert(ArenaRingWriteTo(ring, out[1], page_size) == 0);
+	char echoed[sizeof(message)];
+	assert(ArenaReadAll(out[0], echoed, sizeof(echoed)) == 0);
+	assert(strcmp(echoed, message) == 0);
+	close(in[0]);
+	close(in[1]);
+	close(out[0]);
+	close(out[1]);
+	ArenaRingRelease(ring);
+
+	ring = ArenaRingAlloc(1);
+	pthread_t producer;
+	assert(pthread_create(&producer, NULL, ring_producer, ring) == 0);
+	for (uint64_t i = 0; i < RING_MESSAGES; i++) {
+		size_t size = sizeof(uint64_t) * (1 + i % 5);
+		uint64_t* msg;
+		while (!(msg = (uint64_t*)ArenaRingPeek(ring, &available)) || available < size) {
+			sched_yield();
+		}
+		for (size_t j = 0; j < size / sizeof(uint64_t); j++) {
+			assert(msg[j] == i);
+		}
+		ArenaRingDrop(ring, size);
+	}
+	pthread_join(producer, NULL);
+	assert(ArenaRingPeek(ring, &available) == NULL);
+	ArenaRingRelease(ring);
+}
+
+/* Test ArenaFramesAlloc and ArenaFrameBegin.
+ * Frames must rotate through the arenas, keep the data of earlier frames
+ * until their arena comes round again, and give back the pages of a big
+ * frame once later frames stay small.
+ */
+static void test_ArenaFrames(void) {
+	printf("Running test_ArenaFrames...\n");
+	long page_size = getpagesize();
+	ArenaFrames* frames = ArenaFramesAlloc(3, 64, true);
+	assert(frames != NULL);
+	Arena* seen[3];
+	for (int frame = 0; frame < 3; frame++) {
+		Arena* arena = ArenaFrameBegin(frames);
+		assert(arena->ptr == arena->first_ptr);
+		seen[frame] = arena;
+		long* value = (long*)ArenaPush(arena, sizeof(long));
+		*value = frame;
+		ArenaPushHigh(arena, 64);
+	}
+	assert(seen[0] != seen[1] && seen[1] != seen[2] && seen[0] != seen[2]);
+	assert(ArenaFrameAgo(frames, 0) == seen[2] && ArenaFrameAgo(frames, 2) == seen[0]);
+	// The two frames before the current one are still intact.
+	assert(*(long*)seen[1]->first_ptr == 1 && *(long*)seen[0]->first_ptr == 0);
+
+	// The fourth frame reuses the first arena, emptied at both ends.
+	Arena* arena = ArenaFrameBegin(frames);
+	assert(arena == seen[0]);
+	assert(arena->ptr == arena->first_ptr && arena->high_ptr == arena->end_ptr);
+	assert(*(long*)seen[2]->first_ptr == 2);
+
+	// One big frame, then small ones until its pages are given back.
+	char* big = (char*)ArenaPush(arena, 60 * page_size);
+	memset(big, 1, 60 * page_size);
+	assert(resident_pages(arena, arena->size) >= 60);
+	for (int frame = 0; frame < 90; frame++) {
+		ArenaPush(ArenaFrameBegin(frames), 100);
+	}
+	for (int i = 0; i < 3; i++) {
+		assert(resident_pages(seen[i], seen[i]->size) <= 4);
+	}
+	ArenaFramesRelease(frames);
+
+	// Without decommit the pages stay.
+	frames = ArenaFramesAlloc(2, 64, false);
+	arena = ArenaFrameBegin(frames);
+	memset(ArenaPush(arena, 60 * page_size), 1, 60 * page_size);
+	for (int frame = 0; frame < 10; frame++) {
+		ArenaFrameBegin(frames);
+	}
+	assert(resident_pages(arena, arena->size) >= 60);
+	ArenaFramesRelease(frames);
+}
+
+/* Test epoch based reclamation.
+ * Retired drops must wait for readers that entered before them, run once
+ * those readers leave, and readers must never see a node that has been
+ * recycled under them while a writer keeps replacing it.
+ */
+typedef struct EpochNode {
+	long value;
+	long twice;
+} EpochNode;
+
+typedef struct EpochShared {
+	ArenaEpoch* domain;
+	EpochNode* current;
+	int stop;
+	long torn;
+} EpochShared;
+
+static void* epoch_reader(void* arg) {
+	EpochShared* shared = (EpochShared*)arg;
+	ArenaEpochReader* reader = ArenaEpochJoin(shared->domain);
+	assert(reader != NULL);
+	while (!__atomic_load_n(&shared->stop, __ATOMIC_ACQUIRE)) {
+		ArenaEpochEnter(reader);
+		EpochNode* node = __atomic_load_n(&shared->current, __ATOMIC_ACQUIRE);
+		long value = node->value;
+		sched_yield();
+		if (node->twice != value * 2) {
+			__atomic_add_fetch(&shared->torn, 1, __ATOMIC_RELAXED);
+		}
+		ArenaEpochLeave(reader);
+	}
+	ArenaEpochQuit(reader);
+	return NULL;
+}
+
+static void test_ArenaEpoch(void) {
+	printf("Running test_ArenaEpoch...\n");
+	ArenaEpoch* domain = ArenaEpochAlloc(1);
+	ArenaEpochReader* reader = ArenaEpochJoin(domain);
+	assert(reader != NULL);
+
+	// A roll back waits for the reader that was inside when it was retired.
+	Arena* arena = ArenaAlloc(4);
+	ArenaPush(arena, 64);
+	void* mark = (void*)arena->ptr;
+	ArenaPush(arena, 128);
+	ArenaEpochEnter(reader);
+	assert(ArenaRetireDropTo(domain, arena, mark) == 0);
+	assert(ArenaEpochReclaim(domain) == 0);
+	assert(arena->ptr > (uintptr_t)mark);
+	ArenaEpochLeave(reader);
+	assert(ArenaEpochReclaim(domain) == 1);
+	assert(arena->ptr == (uintptr_t)mark);
+
+	// Readers that enter once the epoch has moved on don't hold it up.
+	ArenaPush(arena, 128);
+	assert(ArenaRetireDropTo(domain, arena, mark) == 0);
+	ArenaEpochEnter(reader);
+	assert(ArenaEpochReclaim(domain) == 0);
+	ArenaEpochLeave(reader);
+	ArenaEpochEnter(reader);
+	assert(ArenaEpochReclaim(domain) == 1);
+	assert(arena->ptr == (uintptr_t)mark);
+	ArenaEpochLeave(reader);
+
+	// A roll back is skipped if the arena has been pushed to since.
+	ArenaPush(arena, 128);
+	ArenaRetireDropTo(domain, arena, mark);
+	void* newer = ArenaPush(arena, 64);
+	ArenaEpochReclaim(domain);
+	assert(arena->ptr > (uintptr_t)newer);
+	ArenaRelease(arena);
+
+	// Slots of a single type Arena are only reused once readers are gone.
+	Arena* pool = ArenaAlloc(4);
+	pool->one_type = true;
+	pool->elem_size = sizeof(EpochNode);
+	EpochNode* nodes[4];
+	for (int i = 0; i < 4; i++) {
+		nodes[i] = (EpochNode*)ArenaPush(pool, sizeof(EpochNode));
+	}
+	ArenaEpochEnter(reader);
+	ArenaRetireDrop(domain, pool, nodes[1]);
+	ArenaEpochReclaim(domain);
+	assert(pool->to_free == NULL);
+	ArenaEpochLeave(reader);
+	ArenaEpochReclaim(domain);
+	assert(ArenaPush(pool, sizeof(EpochNode)) == nodes[1]);
+	ArenaEpochQuit(reader);
+
+	// Fill the retired list past one page, it reclaims on its own.
+	for (int i = 0; i < 1000; i++) {
+		EpochNode* node = (EpochNode*)ArenaPush(pool, sizeof(EpochNode));
+		assert(node != NULL);
+		assert(ArenaRetireDrop(domain, pool, node) == 0);
+	}
+	ArenaEpochRelease(domain);
+
+	// A writer replaces the current node while readers check it.
+	domain = ArenaEpochAlloc(4);
+	EpochShared shared;
+	shared.domain = domain;
+	shared.current = (EpochNode*)ArenaPush(pool, sizeof(EpochNode));
+	shared.stop = 0;
+	shared.torn = 0;
+	pthread_t readers[3];
+	for (int i = 0; i < 3; i++) {
+		assert(pthread_create(&readers[i], NULL, epoch_reader, &shared) == 0);
+	}
+	for (long i = 1; i < 20000; i++) {
+		EpochNode* node = (EpochNode*)ArenaPush(pool, sizeof(EpochNode));
+		assert(node != NULL);
+		node->value = i;
+		node->twice = i * 2;
+		EpochNode* old = __atomic_exchange_n(&shared.current, node, __ATOMIC_ACQ_REL);
+		ArenaRetireDrop(domain, pool, old);
+		if (i % 64 == 0) {
+			ArenaEpochReclaim(domain);
+			sched_yield();
+		}
+	}
+	__atomic_store_n(&shared.stop, 1, __ATOMIC_RELEASE);
+	for (int i = 0; i < 3; i++) {
+		pthread_join(readers[i], NULL);
+	}
+	assert(shared.torn == 0);
+	ArenaEpochRelease(domain);
+	ArenaRelease(pool);
+}
+
+/* Test ArenaSetOwner and remote drops.
+ * Drops from another thread must not touch the owner's free list, and the
+ * owner must get the slots back on its next pushes once its own holes run
+ * out, with and without an occupancy bitmap. Counting, visiting and
+ * compacting must take the remote drops first too.
+ */
+typedef struct RemoteDrops {
+	Arena* arena;
+	long** slots;
+	int count;
+} RemoteDrops;
+
+static void* remote_dropper(void* arg) {
+	RemoteDrops* drops = (RemoteDrops*)arg;
+	for (int i = 0; i < drops->count; i += 2) {
+		ArenaDrop(drops->arena, drops->slots[i]);
+	}
+	return NULL;
+}
+
+static void test_ArenaDropRemote(void) {
+	printf("Running test_ArenaDropRemote...\n");
+	for (int occupancy = 0; occupancy <= 1; occupancy++) {
+		Arena* arena = ArenaAlloc(4);
+		arena->one_type = true;
+		arena->elem_size = 2 * sizeof(long);
+		if (occupancy) {
+			ArenaTrackOccupancy(arena);
+		}
+		ArenaSetOwner(arena);
+		long* slots[64];
+		for (int i = 0; i < 64; i++) {
+			slots[i] = (long*)ArenaPush(arena, arena->elem_size);
+			slots[i][0] = i;
+		}
+		uintptr_t top = arena->ptr;
+		RemoteDrops drops;
+		drops.arena = arena;
+		drops.slots = slots;
+		drops.count = 64;
+		pthread_t thread;
+		assert(pthread_create(&thread, NULL, remote_dropper, &drops) == 0);
+		pthread_join(thread, NULL);
+		assert(arena->remote_free != NULL);
+		assert(arena->to_free == NULL && arena->holes == 0);
+
+		// A local hole is used before the remote ones are looked at.
+		ArenaDrop(arena, slots[1]);
+		assert(ArenaPush(arena, arena->elem_size) == slots[1]);
+		assert(arena->remote_free != NULL);
+
+		// Then the 32 remote drops come back without the arena growing.
+		bool reused[64] = {false};
+		for (int i = 0; i < 32; i++) {
+			long* slot = (long*)ArenaPush(arena, arena->elem_size);
+			assert(slot[0] == 0);
+			int index = (int)(slot - slots[0]) / 2;
+			assert(index >= 0 && index < 64 && index % 2 == 0 && !reused[index]);
+			reused[index] = true;
+		}
+		assert(arena->remote_free == NULL);
+		assert(arena->ptr == top);
+		ArenaPush(arena, arena->elem_size);
+		assert(arena->ptr > top);
+		ArenaRelease(arena);
+	}
+
+	// A remote drop of the top slot is taken before the slots are counted or moved.
+	Arena* arena = ArenaAlloc(1);
+	arena->one_type = true;
+	arena->elem_size = 2 * sizeof(long);
+	ArenaTrackOccupancy(arena);
+	ArenaSetOwner(arena);
+	long* slots[8];
+	for (int i = 0; i < 8; i++) {
+		slots[i] = (long*)ArenaPush(arena, arena->elem_size);
+	}
+	RemoteDrops drops;
+	drops.arena = arena;
+	drops.slots = &slots[7];
+	drops.count = 1;
+	pthread_t thread;
+	assert(pthread_create(&thread, NULL, remote_dropper, &drops) == 0);
+	pthread_join(thread, NULL);
+	assert(ArenaLiveCount(arena) == 7);
+	ArenaDrop(arena, slots[2]);
+	assert(arena->remote_free == NULL);
+	drops.slots = &slots[6];
+	assert(pthread_create(&thread, NULL, remote_dropper, &drops) == 0);
+	pthread_join(thread, NULL);
+	ArenaDefragParallel(arena, 2);
+	assert(arena->remote_free == NULL && arena->holes == 0);
+	assert(arena->ptr == (uintptr_t)slots[5]);
+	assert(ArenaPush(arena, arena->elem_size) == slots[5]);
+	ArenaRelease(arena);
+
+	// ArenaPop on an owned arena still clears the slot.
+	arena = ArenaAlloc(1);
+	arena->one_type = true;
+	arena->elem_size = 2 * sizeof(long);
+	ArenaSetOwner(arena);
+	long* first = (long*)ArenaPush(arena, arena->elem_size);
+	ArenaPush(arena, arena->elem_size);
+	first[1] = 42;
+	ArenaPop(arena, first);
+	assert(first[1] == 0);
+	ArenaRelease(arena);
+}
+
+/* Test ArenaShardsAlloc and ArenaShardPush.
+ * There must be one shard per CPU, pushes from a pinned thread must land
+ * in the shard of its CPU, and pushes from many threads at once must never
+ * hand out overlapping memory.
+ */
+#define SHARD_THREADS 8
+#define SHARD_PUSHES 5000
+
+typedef struct ShardWork {
+	ArenaShards* sharded;
+	long id;
+	long** pushed;
+} ShardWork;
+
+static void* shard_pusher(void* arg) {
+	ShardWork* work = (ShardWork*)arg;
+	for (int i = 0; i < SHARD_PUSHES; i++) {
+		long* p = (long*)ArenaShardPush(work->sharded, 2 * sizeof(long));
+		assert(p != NULL);
+		p[0] = work->id;
+		p[1] = i;
+		work->pushed[i] = p;
+		if (i % 100 == 0) {
+			sched_yield();
+		}
+	}
+	return NULL;
+}
+
+static void test_ArenaShards(void) {
+	printf("Running test_ArenaShards...\n");
+	ArenaShards* sharded = ArenaShardsAlloc(256);
+	assert(sharded->count == (unsigned)sysconf(_SC_NPROCESSORS_CONF));
+	// Pinned to the CPU it is on, so it can't migrate between the checks.
+	cpu_set_t old_set, pinned;
+	assert(sched_getaffinity(0, sizeof(old_set), &old_set) == 0);
+	int cpu = sched_getcpu();
+	bool pin = cpu >= 0;
+	if (pin) {
+		CPU_ZERO(&pinned);
+		CPU_SET(cpu, &pinned);
+		pin = sched_setaffinity(0, sizeof(pinned), &pinned) == 0;
+		cpu = sched_getcpu();
+	}
+	if (pin) {
+		assert(ArenaCurrentCpu() == (unsigned)cpu);
+		Arena* mine = sharded->shards[ArenaCurrentCpu() % sharded->count].arena;
+		uintptr_t before = mine->ptr;
+		void* p = ArenaShardPush(sharded, 64);
+		assert((uintptr_t)p == before && mine->ptr > before);
+		assert(sched_setaffinity(0, sizeof(old_set), &old_set) == 0);
+	} else {
+		assert(ArenaShardPush(sharded, 64) != NULL);
+	}
+
+	Arena* lists = ArenaAlloc((SHARD_THREADS * SHARD_PUSHES * sizeof(long*)) / getpagesize() + 2);
+	ShardWork work[SHARD_THREADS];
+	pthread_t threads[SHARD_THREADS];
+	for (long t = 0; t < SHARD_THREADS; t++) {
+		work[t].sharded = sharded;
+		work[t].id = t;
+		work[t].pushed = (long**)ArenaPush(lists, SHARD_PUSHES * sizeof(long*));
+		assert(pthread_create(&threads[t], NULL, shard_pusher, &work[t]) == 0);
+	}
+	for (int t = 0; t < SHARD_THREADS; t++) {
+		pthread_join(threads[t], NULL);
+	}
+	// Every push still holds what its thread wrote, so none of them overlap.
+	size_t used = 0;
+	for (int t = 0; t < SHARD_THREADS; t++) {
+		for (int i = 0; i < SHARD_PUSHES; i++) {
+			assert(work[t].pushed[i][0] == t && work[t].pushed[i][1] == i);
+		}
+	}
+	for (unsigned i = 0; i < sharded->count; i++) {
+		used += sharded->shards[i].arena->ptr - sharded->shards[i].arena->first_ptr;
+	}
+	assert(used >= SHARD_THREADS * SHARD_PUSHES * 2 * sizeof(long) + 64);
+	ArenaRelease(lists);
+	ArenaShardsRelease(sharded);
+}
+
+/* Test ArenaPoolGet and ArenaPoolPut.
+ * The pool must hand out every slot exactly once, take them all back,
+ * and never give the same slot to two threads at once while they take and
+ * give back slots through magazines and without.
+ */
+#define POOL_THREADS 6
+#define POOL_ROUNDS 20000
+
+typedef struct PoolWork {
+	ArenaPool* pool;
+	long id;
+	long failures;
+} PoolWork;
+
+static void* pool_worker(void* arg) {
+	PoolWork* work = (PoolWork*)arg;
+	ArenaMagazine magazine;
+	magazine.count = 0;
+	ArenaMagazine* mine = work->id % 2 ? &magazine : NULL;
+	long* held[16];
+	for (int round = 0; round < POOL_ROUNDS; round++) {
+		int count = 1 + round % 16;
+		for (int i = 0; i < count; i++) {
+			held[i] = (long*)ArenaPoolGet(work->pool, mine);
+			assert(held[i] != NULL);
+			if (held[i][0] != 0) {
+				work->failures++;
+			}
+			held[i][0] = work->id;
+			held[i][1] = round;
+		}
+		if (round % 64 == 0) {
+			sched_yield();
+		}
+		for (int i = 0; i < count; i++) {
+			if (held[i][0] != work->id || held[i][1] != round) {
+				work->failures++;
+			}
+			ArenaPoolPut(work->pool, mine, held[i]);
+		}
+	}
+	if (mine) {
+		ArenaMagazineFlush(work->pool, mine);
+	}
+	return NULL;
+}
+
+static void test_ArenaPool(void) {
+	printf("Running test_ArenaPool...\n");
+	ArenaPool* pool = ArenaPoolAlloc(3 * sizeof(long), 1);
+	size_t capacity = pool->capacity;
+	assert(capacity > 100);
+	Arena* scratch = ArenaAlloc(capacity * sizeof(void*) / getpagesize() + 2);
+	void** taken = (void**)ArenaPush(scratch, capacity * sizeof(void*));
+	for (size_t i = 0; i < capacity; i++) {
+		taken[i] = ArenaPoolGet(pool, NULL);
+		assert(taken[i] != NULL);
+		assert(i == 0 || taken[i] != taken[i - 1]);
+	}
+	assert(ArenaPoolGet(pool, NULL) == NULL);
+	for (size_t i = 0; i < capacity; i++) {
+		((long*)taken[i])[2] = 7;
+		ArenaPoolPut(pool, NULL, taken[i]);
+	}
+	// A magazine refills from the pool and hands back half when it is full.
+	ArenaMagazine magazine;
+	magazine.count = 0;
+	long* slot = (long*)ArenaPoolGet(pool, &magazine);
+	assert(slot != NULL && slot[0] == 0 && slot[2] == 0);
+	assert(magazine.count == ARENA_MAGAZINE_SIZE / 2);
+	for (int i = 0; i < ARENA_MAGAZINE_SIZE / 2; i++) {
+		ArenaPoolPut(pool, &magazine, ArenaPoolGet(pool, NULL));
+	}
+	assert(magazine.count == ARENA_MAGAZINE_SIZE);
+	ArenaPoolPut(pool, &magazine, slot);
+	assert(magazine.count == ARENA_MAGAZINE_SIZE / 2 + 1);
+	ArenaMagazineFlush(pool, &magazine);
+	assert(magazine.count == 0);
+	// Everything is back in the pool.
+	for (size_t i = 0; i < capacity; i++) {
+		assert(ArenaPoolGet(pool, NULL) != NULL);
+	}
+	assert(ArenaPoolGet(pool, NULL) == NULL);
+	ArenaRelease(scratch);
+	ArenaPoolRelease(pool);
+
+	pool = ArenaPoolAlloc(2 * sizeof(long), 64);
+	PoolWork work[POOL_THREADS];
+	pthread_t threads[POOL_THREADS];
+	for (long t = 0; t < POOL_THREADS; t++) {
+		work[t].pool = pool;
+		work[t].id = t + 1;
+		work[t].failures = 0;
+		assert(pthread_create(&threads[t], NULL, pool_worker, &work[t]) == 0);
+	}
+	for (int t = 0; t < POOL_THREADS; t++) {
+		pthread_join(threads[t], NULL);
+		assert(work[t].failures == 0);
+	}
+	size_t free_slots = 0;
+	while (ArenaPoolGet(pool, NULL)) {
+		free_slots++;
+	}
+	assert(free_slots == pool->capacity);
+	ArenaPoolRelease(pool);
+}
+
+/* Test ArenaPushWithCleanup.
+ * ArenaDropTo must run the finalizers of everything above the position,
+ * newest first, and leave the rest for ArenaRelease. Plain pushes in
+ * between must not get in the way.
+ */
+typedef struct CleanupLog {
+	int order[8];
+	int count;
+} CleanupLog;
+
+typedef struct CleanupObj {
+	CleanupLog* log;
+	int id;
+} CleanupObj;
+
+static void log_cleanup(void* obj) {
+	CleanupObj* o = (CleanupObj*)obj;
+	o->log->order[o->log->count++] = o->id;
+}
+
+static void close_fd(void* obj) {
+	close(*(int*)obj);
+}
+
+static void test_ArenaPushWithCleanup(void) {
+	printf("Running test_ArenaPushWithCleanup...\n");
+	CleanupLog log;
+	log.count = 0;
+	Arena* arena = ArenaAlloc(1);
+	CleanupObj* objs[5];
+	void* marks[5];
+	for (int i = 0; i < 5; i++) {
+		marks[i] = (void*)arena->ptr;
+		objs[i] = (CleanupObj*)ArenaPushWithCleanup(arena, sizeof(CleanupObj), log_cleanup);
+		assert(objs[i] == marks[i]);
+		objs[i]->log = &log;
+		objs[i]->id = i;
+		ArenaPush(arena, 24);
+	}
+	ArenaDropTo(arena, marks[3]);
+	assert(log.count == 2 && log.order[0] == 4 && log.order[1] == 3);
+	assert(arena->ptr == (uintptr_t)marks[3]);
+	// Dropping into the middle of an object counts as dropping it.
+	ArenaDropTo(arena, (char*)objs[2] + 8);
+	assert(log.count == 3 && log.order[2] == 2);
+	ArenaDropTo(arena, marks[2]);
+	assert(log.count == 3);
+
+	int fds[2];
+	assert(pipe(fds) == 0);
+	int* fd = (int*)ArenaPushWithCleanup(arena, sizeof(int), close_fd);
+	*fd = fds[0];
+	ArenaRelease(arena);
+	assert(log.count == 5 && log.order[3] == 1 && log.order[4] == 0);
+	// The read end was closed, so writing to the pipe fails.
+	signal(SIGPIPE, SIG_IGN);
+	assert(write(fds[1], "x", 1) == -1);
+	close(fds[1]);
+	signal(SIGPIPE, SIG_DFL);
+}
+
+/* Test ArenaPushAligned and the typed push macros.
+ * Over-aligned pushes must be aligned without changing the arena's
+ * alignment, and must not pad when ptr is aligned already.
+ */
+typedef struct Vec8 {
+	alignas(32) float v[8];
+} Vec8;
+
+typedef struct Small {
+	int a;
+	short b;
+} Small;
+
+static void test_ArenaPushAligned(void) {
+	printf("Running test_ArenaPushAligned...\n");
+	Arena* arena = ArenaAlloc(2);
+	Small* small = ArenaPushStruct(arena, Small);
+	assert(small != NULL && (uintptr_t)small % alignof(Small) == 0);
+	char* line = (char*)ArenaPushAligned(arena, 64, 64);
+	assert((uintptr_t)line % 64 == 0);
+	assert(arena->alignment == 8);
+	// The next push starts right after the buffer.
+	Small* next = ArenaPushStruct(arena, Small);
+	assert((uintptr_t)next == (uintptr_t)line + 64);
+
+	// No padding when ptr is aligned already.
+	uintptr_t before = (arena->ptr + 63) & ~(uintptr_t)63;
+	ArenaPush(arena, before - arena->ptr ? before - arena->ptr : 64);
+	uintptr_t at = arena->ptr;
+	assert(at % 64 == 0);
+	assert((uintptr_t)ArenaPushAligned(arena, 8, 64) == at);
+	assert(arena->ptr == at + 8);
+
+	Vec8* vecs = ArenaPushArray(arena, Vec8, 4);
+	assert((uintptr_t)vecs % 32 == 0);
+	vecs[3].v[7] = 1.0f;
+	assert(arena->ptr >= (uintptr_t)(vecs + 4));
+	// Alignments the arena already gives go straight to ArenaPush.
+	uintptr_t ptr = arena->ptr;
+	assert((uintptr_t)ArenaPushAligned(arena, 3, 4) == ptr);
+	assert(ArenaPushAligned(arena, arena->size, 64) == NULL);
+	ArenaRelease(arena);
+
+	// A single type Arena would hand back a hole of elem_size, so it is refused.
+	Arena* typed = ArenaAlloc(1);
+	typed->one_type = true;
+	typed->elem_size = 16;
+	void* hole = ArenaPush(typed, 16);
+	ArenaPush(typed, 16);
+	ArenaDrop(typed, hole);
+	assert(ArenaPushAligned(typed, 64, 8) == NULL);
+	ArenaRelease(typed);
+}
+
+/* Test ArenaAllocSub.
+ * Sub-arenas must live inside the parent, keep their own bounds, nest,
+ * and give their block back to the parent when released on top. Live
+ * sub-arenas must be torn down, finalizers and all, when the parent is
+ * dropped to below them or released, and only once if they were released
+ * first.
+ */
+static void test_ArenaAllocSub(void) {
+	printf("Running test_ArenaAllocSub...\n");
+	Arena* parent = ArenaAlloc(4);
+	ArenaPush(parent, 100);
+	uintptr_t mark = parent->ptr;
+	Arena* sub = ArenaAllocSub(parent, 4096);
+	assert(sub != NULL && sub->parent == parent && parent->children == 1);
+	assert((uintptr_t)sub >= mark && sub->end_ptr <= parent->ptr);
+	assert((uintptr_t)sub % 64 == 0 && (uintptr_t)sub - mark < 64);
+	uintptr_t sub_at = (uintptr_t)sub;
+	int* a = (int*)ArenaPush(sub, sizeof(int));
+	*a = 42;
+	assert((uintptr_t)a > (uintptr_t)sub && (uintptr_t)a < sub->end_ptr);
+	// Bounds checks are the sub-arena's own, not the parent's.
+	assert(ArenaPush(sub, 4096) == NULL);
+	assert(ArenaTrackDirty(sub) == -1);
+
+	// A single type sub-arena nested in the first one.
+	Arena* inner = ArenaAllocSub(sub, 1024);
+	assert(inner != NULL && sub->children == 1);
+	inner->one_type = true;
+	inner->elem_size = sizeof(long);
+	long* l1 = (long*)ArenaPush(inner, sizeof(long));
+	long* l2 = (long*)ArenaPush(inner, sizeof(long));
+	*l1 = 1;
+	*l2 = 2;
+	ArenaPop(inner, l1);
+	assert(ArenaPush(inner, sizeof(long)) == l1 && *l1 == 0);
+	uintptr_t inner_at = (uintptr_t)inner;
+	assert(ArenaRelease(inner) == 0);
+	assert(sub->children == 0 && sub->ptr <= inner_at);
+	assert(*a == 42);
+
+	// Releasing the top sub-arena drops the parent back.
+	assert(ArenaRelease(sub) == 0);
+	assert(parent->children == 0 && parent->ptr == sub_at);
+
+	// Released out of order, the lower block stays until the parent is dropped below it.
+	Arena* first = ArenaAllocSub(parent, 512);
+	Arena* second = ArenaAllocSub(parent, 512);
+	assert(first && second && parent->children == 2);
+	ArenaRelease(first);
+	assert(parent->ptr > (uintptr_t)second);
+	ArenaRelease(second);
+	assert(parent->ptr == (uintptr_t)second && parent->children == 0);
+	ArenaDropTo(parent, (void*)mark);
+
+	// Dropping the parent below live sub-arenas tears them down, nested ones too.
+	CleanupLog log = {{0}, 0};
+	Arena* outer = ArenaAllocSub(parent, 2048);
+	Arena* nested = ArenaAllocSub(outer, 512);
+	CleanupObj* obj = (CleanupObj*)ArenaPushWithCleanup(nested, sizeof(CleanupObj), log_cleanup);
+	obj->log = &log;
+	obj->id = 1;
+	obj = (CleanupObj*)ArenaPushWithCleanup(outer, sizeof(CleanupObj), log_cleanup);
+	obj->log = &log;
+	obj->id = 2;
+	assert(parent->children == 1 && outer->children == 1);
+	ArenaDropTo(parent, (void*)mark);
+	assert(log.count == 2 && log.order[0] == 2 && log.order[1] == 1);
+	assert(parent->children == 0 && parent->cleanups == NULL);
+
+	// One released on its own isn't torn down again by the parent.
+	Arena* released = ArenaAllocSub(parent, 512);
+	obj = (CleanupObj*)ArenaPushWithCleanup(released, sizeof(CleanupObj), log_cleanup);
+	obj->log = &log;
+	obj->id = 3;
+	ArenaPush(parent, 16);
+	ArenaRelease(released);
+	assert(log.count == 3 && parent->children == 0);
+	ArenaDropTo(parent, (void*)mark);
+	assert(log.count == 3 && parent->cleanups == NULL);
+
+	// The block is zeroed even when the parent memory was used before.
+	memset((void*)parent->ptr, 0xff, 2048);
+	Arena* again = ArenaAllocSub(parent, 2048);
+	char* bytes = (char*)ArenaPush(again, 1024);
+	for (int i = 0; i < 1024; i++) {
+		assert(bytes[i] == 0);
+	}
+	ArenaRelease(again);
+
+	// Too big for the parent.
+	assert(ArenaAllocSub(parent, parent->size) == NULL);
+	assert(parent->children == 0);
+	// Releasing the parent tears down what is still live in it.
+	Arena* live = ArenaAllocSub(parent, 512);
+	obj = (CleanupObj*)ArenaPushWithCleanup(live, sizeof(CleanupObj), log_cleanup);
+	obj->log = &log;
+	obj->id = 4;
+	ArenaRelease(parent);
+	assert(log.count == 4 && log.order[3] == 4);
+
+	// The internal scratch arenas come from the thread scratch arena now; keep using them in a loop.
+	Arena* arena = ArenaAlloc(4);
+	arena->one_type = true;
+	arena->elem_size = sizeof(long);
+	long* x = (long*)ArenaPush(arena, sizeof(long));
+	long* y = (long*)ArenaPush(arena, sizeof(long));
+	*x = 1;
+	*y = 2;
+	for (int i = 0; i < 1000; i++) {
+		ArenaSwap(arena, x, y);
+	}
+	assert(*x == 1 && *y == 2);
+	ArenaRelease(arena);
+}
+
+/* Test the arena registry and ArenaReport.
+ * Names must show up with the used bytes and holes of each arena, side
+ * arenas like free lists must not take rows of their own while the slot
+ * arena of a pool does, released arenas must drop out, arenas that don't fit in the registry must be counted,
+ * and the report must be triggered by a signal.
+ */
+static void test_ArenaReport(void) {
+	printf("Running test_ArenaReport...\n");
+	int before = ArenaReport(-1);
+	Arena* arena = ArenaAlloc(64);
+	assert(ArenaSetName(arena, "test_report_bytes") == 0);
+	memset(ArenaPush(arena, 40 * 1024), 1, 40 * 1024);
+	Arena* typed = ArenaAlloc(16);
+	typed->one_type = true;
+	typed->elem_size = 64;
+	assert(ArenaSetName(typed, "test_report_holes") == 0);
+	void* elems[32];
+	for (int i = 0; i < 32; i++) {
+		elems[i] = ArenaPush(typed, 64);
+	}
+	for (int i = 0; i < 32; i += 2) {
+		ArenaDrop(typed, elems[i]);
+	}
+	Arena* parent = ArenaAlloc(4);
+	Arena* sub = ArenaAllocSub(parent, 4096);
+	assert(ArenaSetName(sub, "sub") == -1);
+
+	// typed has a free list now, which isn't a row of its own.
+	int fd = memfd_create("report", 0);
+	assert(ArenaReport(fd) == before + 3);
+	char text[64 * 1024];
+	ssize_t len = pread(fd, text, sizeof(text) - 1, 0);
+	assert(len > 0);
+	text[len] = 0;
+	// reserved, committed, resident and used KiB, then holes and fragmentation
+	unsigned long reserved, committed, resident, used, holes, frag;
+	char* line = strstr(text, "test_report_bytes");
+	assert(line && sscanf(line + strlen("test_report_bytes"), "%lu %lu %lu %lu %lu %lu", &reserved, &committed, &resident, &used, &holes, &frag) == 6);
+	assert(reserved == 256 && used == 40 && committed >= 40 && committed <= reserved && resident <= committed);
+	assert(holes == 0 && frag == 0);
+	line = strstr(text, "test_report_holes");
+	assert(line && sscanf(line + strlen("test_report_holes"), "%lu %lu %lu %lu %lu %lu", &reserved, &committed, &resident, &used, &holes, &frag) == 6);
+	assert(holes == 16 && frag == 50);
+	assert(strstr(text, "total") != NULL);
+
+	ArenaRelease(typed);
+	ArenaRelease(sub);
+	ArenaRelease(parent);
+	assert(ArenaSetName(typed, "gone") == -1);
+	assert(ftruncate(fd, 0) == 0 && lseek(fd, 0, SEEK_SET) == 0);
+	assert(ArenaReportOnSignal(SIGUSR1, fd) == 0);
+	raise(SIGUSR1);
+	len = pread(fd, text, sizeof(text) - 1, 0);
+	assert(len > 0);
+	text[len] = 0;
+	assert(strstr(text, "test_report_bytes") != NULL);
+	assert(strstr(text, "test_report_holes") == NULL);
+	signal(SIGUSR1, SIG_DFL);
+
+	// Arenas past the end of the registry are counted instead of listed.
+	static Arena* many[ARENA_MAX_REGISTERED];
+	for (int i = 0; i < ARENA_MAX_REGISTERED; i++) {
+		many[i] = ArenaAlloc(1);
+	}
+	assert(ftruncate(fd, 0) == 0 && lseek(fd, 0, SEEK_SET) == 0);
+	assert(ArenaReport(fd) == ARENA_MAX_REGISTERED);
+	len = pread(fd, text, sizeof(text) - 1, 0);
+	text[len] = 0;
+	assert(strstr(text, "are not listed") != NULL);
+	for (int i = 0; i < ARENA_MAX_REGISTERED; i++) {
+		ArenaRelease(many[i]);
+	}
+
+	// The slots of a pool hold user data and are listed, its holder isn't.
+	before = ArenaReport(-1);
+	ArenaPool* pool = ArenaPoolAlloc(64, 4);
+	assert(ArenaSetName(pool->arena, "test_report_pool") == 0);
+	assert(ArenaSetName(pool->holder, "holder") == -1);
+	assert(ftruncate(fd, 0) == 0 && lseek(fd, 0, SEEK_SET) == 0);
+	assert(ArenaReport(fd) == before + 1);
+	len = pread(fd, text, sizeof(text) - 1, 0);
+	text[len] = 0;
+	assert(strstr(text, "test_report_pool") != NULL);
+	ArenaPoolRelease(pool);
+	assert(ArenaReport(-1) == before);
+	close(fd);
+	ArenaRelease(arena);
+}
+
+/* Test ArenaPublishStats and the shared stats page.
+ * The counters must follow pushes, drops and failed pushes at both ends
+ * of the arena and the holes of a single type Arena, a reader mapping the
+ * page by pid must see them, shared memory arenas must be refused, and
+ * released arenas must free their slot.
+ */
+static void test_ArenaPublishStats(void) {
+	printf("Running test_ArenaPublishStats...\n");
+	Arena* arena = ArenaAlloc(4);
+	ArenaSetName(arena, "stats_arena");
+	assert(arena->stats == NULL);
+	assert(ArenaPublishStats(arena) == 0);
+	assert(arena->stats != NULL);
+	assert(strcmp(arena->stats->name, "stats_arena") == 0);
+	const ArenaStatsPage* page = ArenaAttachStats((long)getpid());
+	assert(page != NULL && page->pid == (uint64_t)getpid());
+	const ArenaStats* seen = NULL;
+	for (int i = 0; i < ARENA_MAX_REGISTERED; i++) {
+		if (page->stats[i].arena == (uint64_t)(uintptr_t)arena) {
+			seen = &page->stats[i];
+		}
+	}
+	assert(seen != NULL);
+	void* mark = (void*)arena->ptr;
+	for (int i = 0; i < 10; i++) {
+		ArenaPush(arena, 100);
+	}
+	ArenaPushAligned(arena, 64, 64);
+	assert(seen->pushes == 11 && seen->used == arena->ptr - arena->first_ptr);
+	uint64_t high_water = seen->used;
+	ArenaDropTo(arena, mark);
+	assert(seen->used == 0 && seen->high_water == high_water);
+	assert(ArenaPush(arena, arena->size) == NULL);
+	assert(seen->failures == 1 && seen->pushes == 11);
+	ArenaSetName(arena, "renamed");
+	assert(strcmp(seen->name, "renamed") == 0);
+	// The top end counts as used too.
+	void* high = (void*)arena->high_ptr;
+	ArenaPushHigh(arena, 256);
+	assert(seen->used == arena->end_ptr - arena->high_ptr && seen->pushes == 12);
+	ArenaDropToHigh(arena, high);
+	assert(seen->used == 0);
+	uint64_t generation = seen->generation;
+
+	ArenaRelease(arena);
+	assert(seen->arena == 0);
+	// The slot is reused with fresh counters.
+	Arena* other = ArenaAlloc(4);
+	assert(ArenaPublishStats(other) == 0);
+	assert(other->stats->pushes == 0 && other->stats->failures == 0 && other->stats->name[0] == 0);
+	if (other->stats == seen) {
+		assert(seen->generation == generation + 1);
+	}
+	ArenaRelease(other);
+
+	// Holes left by ArenaDrop aren't used bytes.
+	Arena* typed = ArenaAlloc(4);
+	typed->one_type = true;
+	typed->elem_size = 64;
+	assert(ArenaPublishStats(typed) == 0);
+	void* elems[4];
+	for (int i = 0; i < 4; i++) {
+		elems[i] = ArenaPush(typed, 64);
+	}
+	assert(typed->stats->used == 4 * 64);
+	ArenaDrop(typed, elems[1]);
+	assert(typed->stats->used == 3 * 64);
+	ArenaPush(typed, 64);
+	assert(typed->stats->used == 4 * 64);
+	ArenaTrackOccupancy(typed);
+	ArenaDrop(typed, elems[0]);
+	assert(typed->stats->used == 3 * 64);
+	ArenaDefrag(typed);
+	assert(typed->stats->used == 3 * 64 && typed->ptr - typed->first_ptr == 3 * 64);
+	ArenaRelease(typed);
+
+	Arena* shared = ArenaAllocShared(NULL, 1, NULL);
+	assert(ArenaPublishStats(shared) == -1 && shared->stats == NULL);
+	ArenaRelease(shared);
+	munmap((void*)page, sizeof(ArenaStatsPage));
+	assert(ArenaUnlinkStats() == 0);
+	assert(ArenaAttachStats((long)getpid()) == NULL);
+}
+
 /* Main function to run all tests */
 int main(void) {
 	test_ArenaAlloc_and_Release();
@@ -180,6 +1911,29 @@ int main(void) {
 	test_ArenaPop();
 	test_ArenaSwap();
 	test_ArenaDefrag();
+	test_ArenaAllocFile();
+	test_ArenaAllocAt_SaveLoad();
+	test_ArenaClone();
+	test_ArenaCheckpoint();
+	test_ArenaShared();
+	test_ArenaTrackOccupancy();
+	test_ArenaForEach();
+	test_ArenaHandles();
+	test_ArenaReorder();
+	test_ArenaDefragParallel();
+	test_ArenaPrefault();
+	test_ArenaPushHigh();
+	test_ArenaRing();
+	test_ArenaFrames();
+	test_ArenaEpoch();
+	test_ArenaDropRemote();
+	test_ArenaShards();
+	test_ArenaPool();
+	test_ArenaPushWithCleanup();
+	test_ArenaPushAligned();
+	test_ArenaAllocSub();
+	test_ArenaReport();
+	test_ArenaPublishStats();
 	printf("All tests passed successfully.\n");
 	return 0;
 }
@@ -0,0 +1,297 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <cstdio>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "arena.hpp"
+
+
+/* -----------------------------------------------------------------------------
+ * Test functions
+ * -----------------------------------------------------------------------------*/
+
+struct Point {
+	long x;
+	long y;
+	Point() = default;
+	Point(long x, long y) : x(x), y(y) {}
+};
+
+/* Test arena::Arena with a trivially destructible type.
+ * Pushes must be zeroed, emplace must construct in place, dropping the
+ * top element must move ptr back and dropping any other must leave a hole
+ * that the next push fills, just like the C API.
+ */
+static void test_TypedArena(void) {
+	printf("Running test_TypedArena...\n");
+	static_assert(arena::Arena<Point>::slot == sizeof(Point), "slot of an aligned type is its size");
+	static_assert(arena::Arena<char, 16>::slot == 16, "slot is rounded up to Align");
+	arena::Arena<Point> points(1);
+	Point* zero = points.push();
+	assert(zero->x == 0 && zero->y == 0);
+	Point* p = points.emplace(3, 4);
+	assert(p == zero + 1 && p->x == 3 && p->y == 4);
+	assert(points.get()->ptr == (uintptr_t)(p + 1));
+	points.drop(p);
+	assert(points.get()->ptr == (uintptr_t)p);
+
+	Point* a = points.emplace(1, 1);
+	points.emplace(2, 2);
+	points.drop(a);
+	assert(points.get()->to_free != NULL);
+	Point* reused = points.emplace(5, 6);
+	assert(reused == a && reused->x == 5);
+	assert(points.count() == 3);
+
+	// Alignment bigger than the type.
+	arena::Arena<char, 64> wide(1);
+	char* c = wide.emplace('a');
+	assert((uintptr_t)c % 64 == 0 && *c == 'a');
+	assert((uintptr_t)wide.emplace('b') == (uintptr_t)c + 64);
+
+	// Moving hands the arena over.
+	arena::Arena<Point> moved(std::move(points));
+	assert(points.get() == NULL);
+	assert(moved.count() == 3);
+
+	// Filling the arena up falls back to the C path, which returns NULL.
+	arena::Arena<Point> full(1);
+	size_t pushed = 0;
+	while (full.push()) {
+		pushed++;
+	}
+	assert(pushed > 200);
+}
+
+/* Test arena::Arena with a type that has a destructor.
+ * Elements still live when the arena goes out of scope must be destroyed,
+ * dropped ones exactly once.
+ */
+static int live_counters = 0;
+
+struct Counter {
+	std::string name;
+	Counter(const char* name) : name(name) {
+		live_counters++;
+	}
+	~Counter() {
+		live_counters--;
+	}
+};
+
+struct alignas(64) AlignedCounter {
+	Counter counter;
+	AlignedCounter(const char* name) : counter(name) {}
+};
+
+static void test_TypedArena_destructors(void) {
+	printf("Running test_TypedArena_destructors...\n");
+	{
+		arena::Arena<Counter> counters(4);
+		Counter* first = counters.emplace("first, with a name too long for the small string buffer");
+		counters.emplace("second");
+		counters.emplace("third");
+		assert(live_counters == 3);
+		counters.drop(first);
+		assert(live_counters == 2);
+		assert(counters.count() == 2);
+		Counter* again = counters.emplace("again");
+		assert(again == first);
+	}
+	assert(live_counters == 0);
+}
+
+/* Test arena::ArenaRef.
+ * Objects of different types must each get their own alignment, drop_to
+ * must roll back to a mark, and destructors of what is dropped or still
+ * there on release must run.
+ */
+struct alignas(32) Wide {
+	char bytes[40];
+};
+
+static void test_ArenaRef(void) {
+	printf("Running test_ArenaRef...\n");
+	arena::ArenaRef ref(2);
+	char* c = ref.emplace<char>('x');
+	Wide* w = ref.emplace<Wide>();
+	assert((uintptr_t)w % 32 == 0 && (uintptr_t)w > (uintptr_t)c);
+	void* mark = ref.mark();
+	Point* p = ref.emplace<Point>(7, 8);
+	assert(p->x == 7 && (uintptr_t)p % alignof(Point) == 0);
+	ref.drop_to(mark);
+	assert(ref.mark() == mark);
+
+	// Types with a destructor have it run when they are dropped or released.
+	ref.emplace<Counter>("released");
+	void* keep = ref.mark();
+	ref.emplace<Counter>("dropped");
+	assert(live_counters == 2);
+	ref.drop_to(keep);
+	assert(live_counters == 1);
+	// Over-aligned types with a destructor get their alignment too.
+	ref.emplace<char>('y');
+	AlignedCounter* aligned = ref.emplace<AlignedCounter>("aligned");
+	assert((uintptr_t)aligned % 64 == 0 && live_counters == 2);
+	ref.drop_to(keep);
+	assert(live_counters == 1);
+
+	arena::ArenaRef other(std::move(ref));
+	assert(ref.get() == NULL);
+	::Arena* raw = other.release();
+	assert(other.get() == NULL);
+	ArenaRelease(raw);
+	assert(live_counters == 0);
+}
+
+/* Test emplace with a constructor that throws.
+ * The slot of arena::Arena and the memory and cleanup of arena::ArenaRef
+ * must be given back, so no destructor runs on the half built object and
+ * the next emplace lands where the failed one would have.
+ */
+struct Throwing {
+	Counter counter;
+	Throwing(const char* name, bool fail) : counter(name) {
+		if (fail) {
+			throw 42;
+		}
+	}
+};
+
+static void test_emplace_throws(void) {
+	printf("Running test_emplace_throws...\n");
+	{
+		arena::Arena<Throwing> typed(1);
+		Throwing* first = typed.emplace("first", false);
+		uintptr_t top = typed.get()->ptr;
+		bool caught = false;
+		try {
+			typed.emplace("thrown", true);
+		} catch (int) {
+			caught = true;
+		}
+		assert(caught && live_counters == 1);
+		assert(typed.get()->ptr == top && typed.count() == 1);
+		assert(typed.emplace("second", false) == first + 1);
+		assert(live_counters == 2);
+	}
+	assert(live_counters == 0);
+
+	arena::ArenaRef ref(1);
+	ref.emplace<Throwing>("kept", false);
+	::Arena* raw = ref.get();
+	void* mark = ref.mark();
+	ArenaCleanup* cleanups = raw->cleanups;
+	bool caught = false;
+	try {
+		ref.emplace<Throwing>("thrown", true);
+	} catch (int) {
+		caught = true;
+	}
+	assert(caught && live_counters == 1);
+	assert(raw->cleanups == cleanups);
+	Throwing* next = ref.emplace<Throwing>("next", false);
+	assert((uintptr_t)next >= (uintptr_t)mark && (uintptr_t)next < (uintptr_t)mark + alignof(Throwing));
+	ref.drop_to(mark);
+	assert(live_counters == 1);
+	ArenaRelease(ref.release());
+	assert(live_counters == 0);
+}
+
+/* Test arena::ArenaResource with pmr containers.
+ * Everything the containers allocate must come from the arena, and a
+ * block freed while it is on top of the arena must be given back.
+ */
+static bool in_arena(::Arena* raw, const void* ptr) {
+	return (uintptr_t)ptr >= raw->first_ptr && (uintptr_t)ptr < raw->ptr;
+}
+
+static void test_ArenaResource(void) {
+	printf("Running test_ArenaResource...\n");
+	arena::ArenaRef ref(64);
+	arena::ArenaResource resource(ref);
+	{
+		std::pmr::vector<long> numbers(&resource);
+		for (long i = 0; i < 1000; i++) {
+			numbers.push_back(i);
+		}
+		assert(in_arena(ref.get(), numbers.data()));
+		std::pmr::unordered_map<int, std::pmr::string> names(&resource);
+		for (int i = 0; i < 100; i++) {
+			names.emplace(i, std::pmr::string("a name that is too long for the small string buffer", &resource));
+		}
+		assert(names.size() == 100 && names[42].size() > 40);
+		assert(in_arena(ref.get(), names[42].data()));
+		assert(numbers[999] == 999);
+	}
+
+	// A block on top of the arena is given back when it is freed.
+	void* mark = ref.mark();
+	void* block = resource.allocate(100, 8);
+	assert(block == mark);
+	resource.deallocate(block, 100, 8);
+	assert(ref.mark() == mark);
+	// Over-aligned requests are honoured.
+	void* wide = resource.allocate(10, 256);
+	assert((uintptr_t)wide % 256 == 0);
+	assert(resource.is_equal(resource));
+	arena::ArenaResource other(ref.get());
+	assert(!resource.is_equal(other));
+
+	// Running out of room throws like any other resource.
+	arena::ArenaRef small(1);
+	arena::ArenaResource tight(small);
+	bool threw = false;
+	try {
+		void* huge = tight.allocate(1 << 20, 8);
+		assert(huge == NULL);
+	} catch (const std::bad_alloc&) {
+		threw = true;
+	}
+	assert(threw);
+}
+
+/* Test arena::ArenaAllocator with allocator-aware containers. */
+static void test_ArenaAllocator(void) {
+	printf("Running test_ArenaAllocator...\n");
+	arena::ArenaRef ref(64);
+	arena::ArenaAllocator<int> alloc(ref.get());
+	std::vector<int, arena::ArenaAllocator<int>> numbers(alloc);
+	for (int i = 0; i < 1000; i++) {
+		numbers.push_back(i);
+	}
+	assert(in_arena(ref.get(), numbers.data()));
+	typedef std::pair<const int, long> Entry;
+	std::map<int, long, std::less<int>, arena::ArenaAllocator<Entry>> squares{arena::ArenaAllocator<Entry>(ref.get())};
+	for (int i = 0; i < 100; i++) {
+		squares[i] = (long)i * i;
+	}
+	assert(squares[12] == 144);
+	assert(in_arena(ref.get(), &*squares.find(50)));
+	// Rebound copies use the same arena and compare equal.
+	arena::ArenaAllocator<Entry> rebound(alloc);
+	assert(rebound == alloc && rebound.get() == ref.get());
+	arena::ArenaRef elsewhere(1);
+	assert(arena::ArenaAllocator<int>(elsewhere.get()) != alloc);
+
+	// The last block pushed is given back when it is freed.
+	void* mark = ref.mark();
+	int* block = alloc.allocate(10);
+	alloc.deallocate(block, 10);
+	assert(ref.mark() == mark);
+}
+
+/* Main function to run all tests */
+int main(void) {
+	test_TypedArena();
+	test_TypedArena_destructors();
+	test_ArenaRef();
+	test_emplace_throws();
+	test_ArenaResource();
+	test_ArenaAllocator();
+	printf("All tests passed successfully.\n");
+	return 0;
+}
@@ -5,7 +5,19 @@ int main(int argc, char **argv)
 {
     NOB_GO_REBUILD_URSELF(argc, argv);
     Nob_Cmd cmd = {0};
-    nob_cmd_append(&cmd, "cc", "-Wall", "-Wextra", "-g","-O0", "-o", "test", "main.c");
+    nob_cmd_append(&cmd, "cc", "-Wall", "-Wextra", "-g","-O0", "-pthread", "-o", "test", "main.c");
+    if (!nob_cmd_run_sync(cmd)) return 1;
+    cmd.count = 0;
+    nob_cmd_append(&cmd, "cc", "-Wall", "-Wextra", "-g","-O2", "-pthread", "-o", "bench", "bench.c");
+    if (!nob_cmd_run_sync(cmd)) return 1;
+    cmd.count = 0;
+    nob_cmd_append(&cmd, "c++", "-std=c++17", "-Wall", "-Wextra", "-g","-O0", "-pthread", "-o", "test_cpp", "main.cpp");
+    if (!nob_cmd_run_sync(cmd)) return 1;
+    cmd.count = 0;
+    nob_cmd_append(&cmd, "c++", "-std=c++17", "-Wall", "-Wextra", "-g","-O2", "-pthread", "-o", "bench_cpp", "bench.cpp");
+    if (!nob_cmd_run_sync(cmd)) return 1;
+    cmd.count = 0;
+    nob_cmd_append(&cmd, "cc", "-Wall", "-Wextra", "-g","-O2", "-pthread", "-o", "arenatop", "arenatop.c");
     if (!nob_cmd_run_sync(cmd)) return 1;
     return 0;
 }